@@ -0,0 +1,608 @@
+#include <mnm_internal.h>
+
+#include <stdint.h>          // uint*_t
+#include <stdio.h>           // fclose, fopen, fprintf, printf
+
+#include <barrier>           // barrier
+#include <thread>            // thread
+#include <vector>            // vector
+
+#include <bgfx/bgfx.h>       // bgfx::*
+#include <bgfx/platform.h>   // renderFrame
+
+#include <mnm.h>
+
+namespace mnm
+{
+
+// -----------------------------------------------------------------------------
+// HARNESS
+// -----------------------------------------------------------------------------
+
+struct BenchmarkResult
+{
+    const char* name;
+    const char* unit;
+    double      count;
+    double      seconds;
+};
+
+static std::vector<BenchmarkResult> s_results;
+
+// Keeps the results observable so the measured work isn't optimized away.
+static volatile float s_sink = 0.0f;
+
+static void report(const char* name, const char* unit, double count, double seconds)
+{
+    s_results.push_back({ name, unit, count, seconds });
+
+    printf("%-44s %14.0f %s/s\n", name, count / seconds, unit);
+}
+
+// For the benchmarks without any per-iteration maintenance.
+template <typename Func>
+static void measure(const char* name, const char* unit, double count_per_call, uint32_t calls, Func&& func)
+{
+    func(); // Warm-up.
+
+    Timer timer;
+    timer.tic();
+
+    for (uint32_t i = 0; i < calls; i++)
+    {
+        func();
+    }
+
+    report(name, unit, count_per_call * calls, timer.toc());
+}
+
+static bool write_results(const char* path)
+{
+    FILE* file = fopen(path, "wb");
+
+    if (!file)
+    {
+        fprintf(stderr, "Failed to open '%s' for writing.\n", path);
+        return false;
+    }
+
+    fprintf(file, "{\n  \"renderer\": \"noop\",\n  \"benchmarks\": [\n");
+
+    for (size_t i = 0; i < s_results.size(); i++)
+    {
+        const BenchmarkResult& result = s_results[i];
+
+        fprintf(
+            file,
+            "    { \"name\": \"%s\", \"unit\": \"%s\", \"count\": %.0f, \"seconds\": %.6f, \"per_second\": %.3f }%s\n",
+            result.name,
+            result.unit,
+            result.count,
+            result.seconds,
+            result.count / result.seconds,
+            i + 1 < s_results.size() ? "," : ""
+        );
+    }
+
+    fprintf(file, "  ]\n}\n");
+
+    fclose(file);
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// SHARED STATE
+// -----------------------------------------------------------------------------
+
+// Mirrors the subset of the global context the benchmarks need.
+static VertexLayoutCache   s_vertex_layouts;
+static DefaultProgramCache s_default_programs;
+static GeometryPool        s_geometry_pool;
+static TextureCache        s_textures;
+
+static std::vector<uint8_t> s_frame_memory;
+static ArenaAllocator       s_frame_allocator;
+
+static void init_shared_state()
+{
+    s_vertex_layouts  .init();
+    s_default_programs.init();
+    s_geometry_pool   .init();
+    s_textures        .init();
+
+    s_frame_memory.resize(32 << 20);
+    s_frame_allocator.init({ s_frame_memory.data(), s_frame_memory.size() });
+}
+
+static void cleanup_shared_state()
+{
+    s_textures        .cleanup();
+    s_geometry_pool   .cleanup();
+    s_default_programs.cleanup();
+}
+
+// Everything submitted so far is consumed, so the frame memory can be reused.
+static void end_frame()
+{
+    bgfx::frame();
+
+    s_geometry_pool  .update();
+    s_frame_allocator.restart();
+}
+
+
+// -----------------------------------------------------------------------------
+// MEMORY ALLOCATION
+// -----------------------------------------------------------------------------
+
+static void bench_allocators()
+{
+    constexpr uint32_t item_size  = 64;
+    constexpr uint32_t item_count = (4 << 20) / item_size;
+
+    static std::vector<uint8_t> memory(item_count * item_size + 64);
+
+    ArenaAllocator arena;
+    arena.init({ memory.data(), memory.size() });
+
+    measure("allocator/arena", "allocations", item_count, 64, [&]()
+    {
+        arena.restart();
+
+        for (uint32_t i = 0; i < item_count; i++)
+        {
+            s_sink = s_sink + float(arena.allocate(item_size).size());
+        }
+    });
+
+    PoolAllocator pool;
+    pool.init({ memory.data(), memory.size() }, item_size, 16);
+
+    measure("allocator/pool", "allocations", item_count, 64, [&]()
+    {
+        pool.restart();
+
+        for (uint32_t i = 0; i < item_count; i++)
+        {
+            s_sink = s_sink + float(pool.allocate().size());
+        }
+    });
+
+    // Mimics the geometry pool's usage: variable sizes, frees in shuffled order.
+    constexpr uint32_t range_count = 4096;
+
+    std::vector<Range> ranges(range_count);
+    RangeAllocator     range_allocator;
+
+    measure("allocator/range", "allocations", range_count, 64, [&]()
+    {
+        range_allocator.init(1 << 24);
+
+        uint32_t seed = 12345;
+
+        for (Range& range : ranges)
+        {
+            seed = seed * 1664525u + 1013904223u;
+
+            range.size   = 1 + (seed >> 20);
+            range.offset = range_allocator.allocate(range.size);
+        }
+
+        for (uint32_t i = 0; i < range_count; i++)
+        {
+            const Range& range = ranges[(i * 2654435761u) % range_count];
+
+            if (range.offset != UINT32_MAX)
+            {
+                range_allocator.free(range.offset, range.size);
+            }
+        }
+    });
+}
+
+
+// -----------------------------------------------------------------------------
+// VERTEX RECORDING
+// -----------------------------------------------------------------------------
+
+static void bench_vertex_recorder(const char* name, uint32_t flags)
+{
+    constexpr uint32_t vertex_count = 1 << 18;
+
+    const bgfx::VertexLayout& layout = s_vertex_layouts[flags];
+
+    // Emulated quads output six vertices per four submitted ones (the latter
+    // are the ones counted).
+    static std::vector<uint8_t> buffer;
+    buffer.resize(size_t(vertex_count) * 2 * layout.getStride() + 16);
+
+    VertexRecorder recorder;
+
+    measure(name, "vertices", vertex_count, 32, [&]()
+    {
+        recorder.reset(flags, layout, { buffer.data(), buffer.size() });
+
+        for (uint32_t i = 0; i < vertex_count; i++)
+        {
+            recorder.vertex_state.position[0] = float(i & 255);
+            recorder.vertex_state.position[1] = float(i >> 8);
+            recorder.vertex_state.position[2] = 0.0f;
+           *recorder.vertex_state.color       = 0xffffffff;
+
+            recorder.push_current_vertex();
+        }
+
+        s_sink = s_sink + float(recorder.vertex_count);
+    });
+}
+
+
+// -----------------------------------------------------------------------------
+// MESH CREATION
+// -----------------------------------------------------------------------------
+
+// Triangle list of a `size` x `size` grid, with the vertices of neighbouring
+// quads duplicated, as the vertex recorder would output them.
+static void generate_grid(uint32_t size, const bgfx::VertexLayout& layout, std::vector<uint8_t>& buffer)
+{
+    const uint32_t stride = layout.getStride();
+
+    buffer.resize(size_t(size) * size * 6 * stride);
+
+    VertexRecorder recorder;
+    recorder.reset(PRIMITIVE_TRIANGLES, layout, { buffer.data(), buffer.size() });
+
+    const auto add_vertex = [&](uint32_t x, uint32_t y)
+    {
+        recorder.vertex_state.position[0] = float(x);
+        recorder.vertex_state.position[1] = float(y);
+        recorder.vertex_state.position[2] = 0.0f;
+       *recorder.vertex_state.color       = 0xff000000 | (x * 0x0101) | (y << 16);
+
+        recorder.push_current_vertex();
+    };
+
+    for (uint32_t y = 0; y < size; y++)
+    {
+        for (uint32_t x = 0; x < size; x++)
+        {
+            add_vertex(x    , y    );
+            add_vertex(x + 1, y    );
+            add_vertex(x + 1, y + 1);
+
+            add_vertex(x    , y    );
+            add_vertex(x + 1, y + 1);
+            add_vertex(x    , y + 1);
+        }
+    }
+}
+
+static void bench_mesh_create(const char* name, uint32_t flags, uint32_t grid_size)
+{
+    static std::vector<uint8_t> buffer;
+
+    const bgfx::VertexLayout& layout = s_vertex_layouts[flags];
+    generate_grid(grid_size, layout, buffer);
+
+    const MeshDesc desc = { { buffer.data(), buffer.size() }, {}, &layout, flags };
+
+    const uint32_t vertex_count = uint32_t(buffer.size() / layout.getStride());
+    const uint32_t iterations   = bx::max(4000000u / vertex_count, 8u);
+
+    Timer  timer;
+    double seconds = 0.0;
+
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        Mesh mesh;
+
+        timer.tic();
+        mesh.create(desc, s_frame_allocator, s_geometry_pool);
+        seconds += timer.toc();
+
+        mesh.destroy(s_geometry_pool);
+
+        // Releases the transient buffers, BGFX handles, and pooled ranges.
+        end_frame();
+    }
+
+    report(name, "vertices", double(vertex_count) * iterations, seconds);
+}
+
+static void bench_meshes()
+{
+    constexpr uint32_t flags = PRIMITIVE_TRIANGLES | VERTEX_COLOR;
+
+    struct Case
+    {
+        const char* name;
+        uint32_t    flags;
+        uint32_t    grid_size;
+    };
+
+    // The largest grid stays below the 16-bit vertex limit of transient meshes.
+    static const Case cases[] =
+    {
+        { "mesh_create/transient/1536"          , MESH_TRANSIENT                     , 16 },
+        { "mesh_create/transient/24576"         , MESH_TRANSIENT                     , 64 },
+        { "mesh_create/transient/55296"         , MESH_TRANSIENT                     , 96 },
+        { "mesh_create/static/1536"             , MESH_STATIC                        , 16 },
+        { "mesh_create/static/24576"            , MESH_STATIC                        , 64 },
+        { "mesh_create/static/55296"            , MESH_STATIC                        , 96 },
+        { "mesh_create/static_optimized/1536"   , MESH_STATIC | OPTIMIZE_GEOMETRY    , 16 },
+        { "mesh_create/static_optimized/24576"  , MESH_STATIC | OPTIMIZE_GEOMETRY    , 64 },
+        { "mesh_create/static_optimized/55296"  , MESH_STATIC | OPTIMIZE_GEOMETRY    , 96 },
+    };
+
+    for (const Case& test : cases)
+    {
+        bench_mesh_create(test.name, flags | test.flags, test.grid_size);
+    }
+}
+
+
+// -----------------------------------------------------------------------------
+// DRAW SUBMISSION
+// -----------------------------------------------------------------------------
+
+// Stays below BGFX's default limit on draws per frame.
+constexpr uint32_t SUBMIT_DRAWS_PER_FRAME = 60000;
+
+constexpr uint32_t SUBMIT_FRAMES          = 32;
+
+static void submit_draws(bgfx::Encoder& encoder, UniformStaging& staging, const Mesh& mesh, uint32_t count)
+{
+    const hmm_mat4 transform = HMM_Mat4d(1.0f);
+
+    DrawState state;
+    state.reset();
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        state.mesh      = &mesh;
+        state.transform = &transform;
+        state.pass      = 0;
+        state.program   = s_default_programs[mesh.flags];
+
+        state.submit(encoder, staging, s_textures, s_default_programs);
+    }
+}
+
+static void bench_submit(const char* name, const Mesh& mesh, uint32_t thread_count)
+{
+    const uint32_t draws_per_thread = SUBMIT_DRAWS_PER_FRAME / thread_count;
+
+    Timer  timer;
+    double seconds = 0.0;
+
+    if (thread_count == 1)
+    {
+        UniformStaging staging;
+        staging.init();
+
+        for (uint32_t i = 0; i < SUBMIT_FRAMES; i++)
+        {
+            timer.tic();
+
+            bgfx::Encoder* encoder = bgfx::begin();
+            submit_draws(*encoder, staging, mesh, draws_per_thread);
+            bgfx::end(encoder);
+
+            seconds += timer.toc();
+
+            end_frame();
+        }
+
+        staging.cleanup();
+    }
+    else
+    {
+        // Workers stay alive across the frames, so that thread creation isn't
+        // measured. Frame is only ended when none of them holds an encoder.
+        std::barrier<> sync(thread_count + 1);
+
+        std::vector<std::thread> workers;
+
+        for (uint32_t i = 0; i < thread_count; i++)
+        {
+            workers.emplace_back([&]()
+            {
+                UniformStaging staging;
+                staging.init();
+
+                for (uint32_t j = 0; j < SUBMIT_FRAMES; j++)
+                {
+                    sync.arrive_and_wait();
+
+                    bgfx::Encoder* encoder = bgfx::begin(true);
+                    submit_draws(*encoder, staging, mesh, draws_per_thread);
+                    bgfx::end(encoder);
+
+                    sync.arrive_and_wait();
+                }
+
+                staging.cleanup();
+            });
+        }
+
+        for (uint32_t i = 0; i < SUBMIT_FRAMES; i++)
+        {
+            sync.arrive_and_wait();
+            timer.tic();
+
+            sync.arrive_and_wait();
+            seconds += timer.toc();
+
+            end_frame();
+        }
+
+        for (std::thread& worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    report(name, "draws", double(draws_per_thread) * thread_count * SUBMIT_FRAMES, seconds);
+}
+
+static void bench_submission()
+{
+    static std::vector<uint8_t> buffer;
+
+    constexpr uint32_t flags = MESH_STATIC | PRIMITIVE_TRIANGLES | VERTEX_COLOR;
+
+    const bgfx::VertexLayout& layout = s_vertex_layouts[flags];
+    generate_grid(4, layout, buffer);
+
+    Mesh mesh;
+    mesh.create({ { buffer.data(), buffer.size() }, {}, &layout, flags }, s_frame_allocator, s_geometry_pool);
+
+    end_frame();
+
+    bench_submit("draw_submit/threads_1", mesh, 1);
+    bench_submit("draw_submit/threads_2", mesh, 2);
+    bench_submit("draw_submit/threads_4", mesh, 4);
+
+    mesh.destroy(s_geometry_pool);
+
+    end_frame();
+}
+
+
+// -----------------------------------------------------------------------------
+// MATRIX STACK
+// -----------------------------------------------------------------------------
+
+// Hierarchy depth of a single "node" visit in the benchmarks below.
+constexpr uint32_t MATRIX_STACK_BENCH_DEPTH = 16;
+
+// The original scalar path, building the full 4x4 matrix for each operation.
+struct ScalarMatrixStack
+{
+    hmm_mat4 top;
+    hmm_mat4 matrices[MATRIX_STACK_BENCH_DEPTH];
+    uint32_t size;
+
+    void init()
+    {
+        top  = HMM_Mat4d(1.0f);
+        size = 0;
+    }
+
+    void push() { matrices[size++] = top; }
+
+    void pop() { top = matrices[--size]; }
+
+    void translate(const hmm_vec3& offset) { top = HMM_Translate(offset) * top; }
+
+    void scale(const hmm_vec3& factor) { top = HMM_Scale(factor) * top; }
+
+    void rotate(float angle, const hmm_vec3& axis) { top = HMM_Rotate(angle, axis) * top; }
+
+    void multiply_top(const hmm_mat4& matrix) { top = matrix * top; }
+};
+
+template <typename Stack>
+static void bench_hierarchy(Stack& stack, uint32_t iterations)
+{
+    const hmm_vec3 offset = HMM_Vec3(0.5f, 0.25f, -1.0f);
+    const hmm_vec3 factor = HMM_Vec3(1.01f, 0.99f, 1.0f);
+    const hmm_vec3 axis   = HMM_Vec3(0.0f, 1.0f, 0.0f);
+
+    stack.init();
+
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        for (uint32_t j = 0; j < MATRIX_STACK_BENCH_DEPTH; j++)
+        {
+            stack.push();
+            stack.translate(offset);
+            stack.rotate(float(j), axis);
+            stack.scale(factor);
+        }
+
+        s_sink = s_sink + stack.top.Elements[3][0];
+
+        for (uint32_t j = 0; j < MATRIX_STACK_BENCH_DEPTH; j++)
+        {
+            stack.pop();
+        }
+    }
+}
+
+template <typename Stack>
+static void bench_multiply(Stack& stack, uint32_t iterations)
+{
+    const hmm_mat4 matrix = HMM_Rotate(1.0f, HMM_Vec3(0.0f, 0.0f, 1.0f));
+
+    stack.init();
+
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        stack.multiply_top(matrix);
+    }
+
+    s_sink = s_sink + stack.top.Elements[3][0];
+}
+
+static void bench_matrix_stack()
+{
+    constexpr uint32_t iterations = 1 << 14;
+
+    static ScalarMatrixStack scalar;
+    static MatrixStack       simd;
+
+    // Each hierarchy iteration does three operations per level.
+    constexpr double hierarchy_ops = double(iterations) * MATRIX_STACK_BENCH_DEPTH * 3;
+
+    measure("matrix_stack/hierarchy/scalar", "operations", hierarchy_ops, 16, []() { bench_hierarchy(scalar, iterations); });
+    measure("matrix_stack/hierarchy/simd"  , "operations", hierarchy_ops, 16, []() { bench_hierarchy(simd  , iterations); });
+    measure("matrix_stack/multiply/scalar" , "operations", iterations   , 64, []() { bench_multiply (scalar, iterations); });
+    measure("matrix_stack/multiply/simd"   , "operations", iterations   , 64, []() { bench_multiply (simd  , iterations); });
+}
+
+} // namespace mnm
+
+
+// -----------------------------------------------------------------------------
+// MAIN
+// -----------------------------------------------------------------------------
+
+// Usage: mnm_bench [output.json]
+int main(int argc, char** argv)
+{
+    const char* output_path = argc > 1 ? argv[1] : "mnm_bench.json";
+
+    // Single-threaded BGFX (no render thread) with no window, so the results
+    // only contain the library's own CPU work.
+    bgfx::renderFrame();
+
+    bgfx::Init init;
+    init.type              = bgfx::RendererType::Noop;
+    init.resolution.width  = 1280;
+    init.resolution.height = 720;
+    init.resolution.reset  = BGFX_RESET_NONE;
+
+    if (!bgfx::init(init))
+    {
+        fprintf(stderr, "Failed to initialize BGFX.\n");
+        return 1;
+    }
+
+    mnm::init_shared_state();
+
+    mnm::bench_allocators();
+    mnm::bench_vertex_recorder("vertex_recorder/triangles", PRIMITIVE_TRIANGLES | VERTEX_COLOR);
+    mnm::bench_vertex_recorder("vertex_recorder/quads"    , PRIMITIVE_QUADS     | VERTEX_COLOR);
+    mnm::bench_meshes();
+    mnm::bench_submission();
+    mnm::bench_matrix_stack();
+
+    mnm::cleanup_shared_state();
+
+    bgfx::shutdown();
+
+    return mnm::write_results(output_path) ? 0 : 1;
+}
@@ -340,6 +340,34 @@ void tic(void);
 ///
 double toc(void);
 
+/// Enables or disables recording of profiling zones. Disabled by default.
+///
+/// @param[in] enabled Non-zero to record zones.
+///
+void profiling(int enabled);
+
+/// Starts a named profiling zone on the current thread. Zones can be nested,
+/// and each has to be ended by `end_zone` on the same thread. Only the most
+/// recent zones of each thread are kept.
+///
+/// @param[in] name Zone name. Has to stay valid until the trace is dumped, so
+///   typically a string literal.
+///
+void begin_zone(const char* name);
+
+/// Ends the last zone started on the current thread.
+///
+void end_zone(void);
+
+/// Writes the recorded zones of all threads into a JSON file in the Chrome
+/// trace event format (viewable in `chrome://tracing` or Perfetto).
+///
+/// @param[in] path Output file path.
+///
+/// @returns Non-zero if the file was written.
+///
+int dump_trace(const char* path);
+
 
 // -----------------------------------------------------------------------------
 /// @section GEOMETRY RECORDING
@@ -375,7 +403,8 @@ enum
     NO_VERTEX_TRANSFORM = 0x0800,
 
     // Optimizes the mesh data for beter rendering performance, potentially
-    // changing the primitive ordering - don't use if you plan to use `range`.
+    // changing the primitive ordering - don't use if you plan to use `range`
+    // (static batch parts are optimized separately, and thus can be used).
     // Only useful for static or dynamic meshes, and for triangles or quads.
     OPTIMIZE_GEOMETRY   = 0x1000,
 
@@ -383,6 +412,10 @@ enum
     // be specified in the flags.
     MAKE_SMOOTH_NORMALS = 0x2000,
     MAKE_FLAT_NORMALS   = 0x4000,
+
+    // Keeps a CPU copy of the triangles, so that the mesh can be passed to
+    // `occluder`. Only useful for triangles or quads.
+    MESH_OCCLUDER       = 0x8000,
 };
 
 /// Starts mesh geometry recording. Mesh type, primitive type and attributes
@@ -438,6 +471,43 @@ void normal(float nx, float ny, float nz);
 void texcoord(float u, float v);
 
 
+// -----------------------------------------------------------------------------
+/// @section STATIC BATCHING
+///
+/// Static batches merge many small static meshes sharing the same flags into
+/// a single one, submitted by a single `mesh` call. Each merged mesh is
+/// recorded as a batch part and, since its vertices are transformed by the
+/// current matrix when recorded, it can be placed with the matrix stack.
+
+/// Starts static batch recording. Geometry is recorded the same way as with
+/// `begin_mesh`, and the first part starts immediately.
+///
+/// Using existing ID is valid, but results in destruction of the previously
+/// submitted data.
+///
+/// @param[in] id Mesh identifier.
+/// @param[in] flags Mesh flags. `MESH_TRANSIENT` isn't allowed.
+///
+void begin_batch(int id, int flags);
+
+/// Ends the current batch part and starts a new one.
+///
+void batch_part(void);
+
+/// Ends the current static batch recording.
+///
+void end_batch(void);
+
+/// Sets element range of the next submitted `mesh` call to the given static
+/// batch part, so that individual parts can still be culled. Invalid parts
+/// are ignored.
+///
+/// @param[in] id Mesh identifier.
+/// @param[in] part Zero-based part index.
+///
+void batch_range(int id, int part);
+
+
 // -----------------------------------------------------------------------------
 /// @section RENDERING
 ///
@@ -511,6 +581,105 @@ void scissor(int x, int y, int width, int height);
 ///
 void range(int start, int count);
 
+/// Turns deferred submission of the calling thread's `mesh` calls on or off.
+/// Deferred draws are buffered until the end of the frame, and then sorted, so
+/// that the ones sharing shader, texture and mesh are submitted together (and
+/// front-to-back among those). Blended draws are submitted after the opaque
+/// ones of the same pass, in their original order. Off by default.
+///
+/// Runs of deferred draws that differ only in their transform and use the
+/// default shader are automatically merged into a single instanced draw.
+///
+/// @param[in] enabled If non-zero, deferred submission is turned on.
+///
+void deferred(int enabled);
+
+
+// -----------------------------------------------------------------------------
+/// @section MATERIALS
+///
+/// Materials bake a draw state (state flags, shader, texture and uniform
+/// values) once, so that it can be set for a `mesh` call with a single call.
+
+/// Starts material building. Draw state set by `state`, `shader`, `texture`
+/// and `uniform` calls made until `end_material` is called is captured by the
+/// material instead of being applied to the next `mesh` call.
+///
+/// Using existing ID will result in destruction of the previously created data.
+///
+/// @param[in] id Material identifier.
+///
+void begin_material(int id);
+
+/// Ends material building.
+///
+void end_material(void);
+
+/// Sets the material used with next `mesh` call, replacing its draw state
+/// flags, shader (unless the material has none), texture and uniforms.
+///
+/// @param[in] id Material identifier.
+///
+void material(int id);
+
+
+// -----------------------------------------------------------------------------
+/// @section DRAW LISTS
+///
+/// Draw lists record a sequence of `mesh` submissions (with their draw state
+/// already translated), so that static content can be re-submitted each frame
+/// with a single call.
+
+/// Starts draw list recording. Until `end_draw_list` is called, `mesh` calls
+/// made from the calling thread are recorded instead of being submitted. Only
+/// static meshes can be recorded. Recorded lists persist across frames.
+///
+/// Using existing ID will result in destruction of the previously recorded
+/// list.
+///
+/// @param[in] id Draw list identifier.
+///
+void begin_draw_list(int id);
+
+/// Ends the current draw list recording.
+///
+void end_draw_list(void);
+
+/// Submits all draws of a recorded list, into the passes they were recorded
+/// with. The current model matrix is applied on top of the recorded ones.
+///
+/// @param[in] id Draw list identifier.
+///
+void draw_list(int id);
+
+
+// -----------------------------------------------------------------------------
+/// @section OCCLUSION CULLING
+///
+/// Opt-in CPU occlusion culling. Occluder meshes are rasterized in software
+/// into a low-resolution depth buffer, and bounding boxes of the subsequent
+/// `mesh` calls into the same pass are tested against it. Meshes found to be
+/// fully hidden are not submitted at all. Runs entirely on the CPU.
+
+/// Starts collecting occluders for the given pass, using its current view and
+/// projection matrices. Previous occlusion results are discarded.
+///
+/// @param[in] pass Pass identifier.
+///
+void begin_occlusion(int pass);
+
+/// Adds a mesh created with the `MESH_OCCLUDER` flag as an occluder, placed by
+/// the current model matrix. Can be called from any thread.
+///
+/// @param[in] id Mesh identifier.
+///
+void occluder(int id);
+
+/// Rasterizes the collected occluders, split across multiple tasks. Until all
+/// of them finish, no `mesh` call is culled.
+///
+void end_occlusion(void);
+
 
 // -----------------------------------------------------------------------------
 /// @section TEXTURING
@@ -542,6 +711,20 @@ enum
     TEXTURE_READ_BACK  = 0x0080,
     TEXTURE_WRITE_ONLY = 0x0100,
     TEXTURE_BLIT_DST   = 0x0200,
+
+    // Generates the full mip chain on the CPU from the provided content (RGBA8
+    // one is treated as gamma-encoded). No mips by default.
+    TEXTURE_MIPMAPS    = 0x0400,
+
+    // Block compression of the provided RGBA8 content, done on the CPU (slow,
+    // see `texture_cache_dir`). Precompressed DDS / KTX content is used as is.
+    // BC4 and BC5 keep only the red, or red and green channels. None by
+    // default.
+    TEXTURE_BC1        = 0x0800,
+    TEXTURE_BC3        = 0x1000,
+    TEXTURE_BC4        = 0x1800,
+    TEXTURE_BC5        = 0x2000,
+    TEXTURE_BC7        = 0x2800,
 };
 
 /// Automatic texture size related to backbuffer size. When a window is resized,
@@ -566,6 +749,9 @@ enum
 /// The passed data memory must stay valid for at least two frames. See `alloc`
 /// and `MEMORY_TEMPORARY` for creation of autmatically disposed memory.
 ///
+/// Tightly packed content (`stride` zero or equal to the row size) without
+/// `TEXTURE_MIPMAPS` is uploaded directly from `data`, without extra copy.
+///
 /// @param[in] id Texture identifier.
 /// @param[in] flags Texture properties' flags.
 /// @param[in] width Image width in pixels.
@@ -575,11 +761,120 @@ enum
 ///
 void load_texture(int id, int flags, int width, int height, int stride, const void* data);
 
+/// Like `load_texture`, but the `release` callback is called once the `data`
+/// is no longer needed (possibly from the rendering thread), so that it
+/// doesn't have to be kept around for two frames.
+///
+/// @param[in] release Function called with `data` and `user_data`, once
+///   the upload is done.
+/// @param[in] user_data Pointer passed to `release`.
+///
+void load_texture_ref(int id, int flags, int width, int height, int stride, const void* data, void (* release)(void* data, void* user_data), void* user_data);
+
+/// Loads a texture from an in-memory image file (PNG, JPEG, TGA, DDS, KTX,
+/// etc.). Block-compressed DDS / KTX content is uploaded directly, including
+/// its mips. Decoding runs on the calling thread, so prefer
+/// `load_texture_async` for large uncompressed images.
+///
+/// @param[in] id Texture identifier.
+/// @param[in] flags Texture properties' flags. Render target flags are ignored.
+/// @param[in] data File contents. Not referenced after the call.
+/// @param[in] size File contents size in bytes.
+///
+void load_texture_blob(int id, int flags, const void* data, int size);
+
+/// Sets the directory where the CPU-compressed textures are cached, keyed by
+/// their source content. Must exist and be writable. No caching, if empty or
+/// `NULL` (default). Should not be changed while textures are being loaded.
+///
+/// @param[in] path Cache directory path.
+///
+void texture_cache_dir(const char* path);
+
 /// Like `load_texture`, but no existing content is provided. Also supports
 /// automatic backbuffer-size-related scaling.
 ///
 void create_texture(int id, int flags, int width, int height);
 
+/// Updates a region of an existing texture. The texture must have been created
+/// without content (see `create_texture`), and can't be compressed. The data is
+/// copied, so it doesn't need to stay valid after the call. The uploads are
+/// done at the end of the frame, with updates of adjacent or overlapping
+/// regions merged.
+///
+/// @param[in] id Texture identifier.
+/// @param[in] x Region's left edge in pixels.
+/// @param[in] y Region's top edge in pixels.
+/// @param[in] width Region width in pixels.
+/// @param[in] height Region height in pixels.
+/// @param[in] stride Data stride in bytes. Pass zero to auto-compute.
+/// @param[in] data Pixel data.
+///
+void update_texture(int id, int x, int y, int width, int height, int stride, const void* data);
+
+/// Like `create_texture`, but the render target only lives in the given pass
+/// range of the current frame, and must be requested again in each frame.
+/// Textures with the same flags and size are pooled and shared by the
+/// transient targets whose pass ranges don't overlap, so a chain of
+/// post-processing passes needs only a couple of them. Reading the texture
+/// outside the pass range, or in later frames, is undefined. The ranges are
+/// in pass ID order, so while the render graph is enabled (and might reorder
+/// the passes), transient targets aren't shared.
+///
+/// @param[in] id Texture identifier.
+/// @param[in] flags Texture properties' flags. `TEXTURE_TARGET` is implied.
+/// @param[in] width Texture width in pixels, or one of `SIZE_*` values.
+/// @param[in] height Texture height in pixels, or one of `SIZE_*` values.
+/// @param[in] first_pass First pass using the texture (rendering or sampling).
+/// @param[in] last_pass Last pass using the texture.
+///
+void transient_texture(int id, int flags, int width, int height, int first_pass, int last_pass);
+
+/// Loads a texture from an image file (PNG, JPEG, TGA, DDS, KTX, etc.) in the
+/// background. Reading and decoding the file runs as a task, and the texture
+/// is created at the start of a later frame. Until then, a 1x1 placeholder is
+/// used in its place.
+///
+/// Using existing ID will result in destruction of the previously created data,
+/// and a pending load with the same ID is discarded once it finishes. Loads
+/// still in progress at shutdown are waited for.
+///
+/// @param[in] id Texture identifier.
+/// @param[in] flags Texture properties' flags. Render target flags are ignored.
+/// @param[in] path Image file path.
+///
+void load_texture_async(int id, int flags, const char* path);
+
+/// Checks whether an asynchronously loaded texture has been created. Textures
+/// that failed to load stay non-resident.
+///
+/// @param[in] id Texture identifier.
+///
+/// @returns Non-zero if the texture content is available.
+///
+int texture_resident(int id);
+
+/// Sets the texture memory budget. When exceeded, the least recently used
+/// textures are evicted at the end of the frame. Only textures loaded with
+/// content are evicted (not render targets, atlases, textures without
+/// initial data, or textures used by materials and recorded draw lists).
+/// Evicted textures behave as if never loaded.
+///
+/// @param[in] megabytes Budget in MiB. Zero (default) disables the eviction.
+///
+void texture_budget(int megabytes);
+
+/// Sets the functions called when a texture is evicted, and when an evicted
+/// texture is used again, so that it can be reloaded (e.g., with
+/// `load_texture_async`). Either can be `NULL`. The reload function may be
+/// called from any thread that calls `texture`.
+///
+/// @param[in] evicted Function called with evicted texture ID.
+/// @param[in] reload Function called with evicted texture ID when requested.
+/// @param[in] user_data Pointer passed to both functions.
+///
+void texture_eviction_callbacks(void (* evicted)(int id, void* user_data), void (* reload)(int id, void* user_data), void* user_data);
+
 /// Sets the active texture which is used with next `mesh` call, or, if called
 /// between `begin_framebuffer` and `end_framebuffer` calls, it adds the texture
 /// as the framebuffer's attachment.
@@ -589,6 +884,41 @@ void create_texture(int id, int flags, int width, int height);
 void texture(int id);
 
 
+// -----------------------------------------------------------------------------
+/// @section TEXTURE ATLASES
+///
+/// Atlases pack many small images into a single texture, so that draws using
+/// them share the texture binding and can be batched together.
+
+/// Creates an empty atlas texture. Using existing ID will result in destruction
+/// of the previously created data, including any packed images. Use the
+/// `texture` function with the same ID to submit the atlas.
+///
+/// @param[in] id Texture identifier.
+/// @param[in] flags Texture properties' flags. Only sampling, border mode and
+///   color formats are supported.
+/// @param[in] width Atlas width in pixels.
+/// @param[in] height Atlas height in pixels.
+///
+void create_atlas(int id, int flags, int width, int height);
+
+/// Packs an image into the atlas and schedules its upload. The data is copied,
+/// so it doesn't need to stay valid after the call. A one pixel border around
+/// the image is filled with its edge pixels, to avoid bleeding between images.
+///
+/// @param[in] id Atlas texture identifier.
+/// @param[in] width Image width in pixels.
+/// @param[in] height Image height in pixels.
+/// @param[in] stride Image stride in bytes. Pass zero to auto-compute.
+/// @param[in] data Pixel data, in the atlas format.
+/// @param[out] uv Image rectangle texture coordinates (left, top, right,
+///   bottom).
+///
+/// @returns Non-zero if the image was packed, zero if the atlas is full.
+///
+int add_atlas_image(int id, int width, int height, int stride, const void* data, float* uv);
+
+
 // -----------------------------------------------------------------------------
 /// @section TEXTURE READBACK
 ///
@@ -615,6 +945,26 @@ void read_texture(int id, void* data);
 ///
 int read_screen(void* data);
 
+/// Schedules a texture content to be read back, and passed to the `callback`,
+/// executed from a worker thread, once available. Up to three reads of the
+/// same texture can be in flight, so it's possible to read every frame, with
+/// a fixed latency (typically two frames). The texture must have been created
+/// with `TEXTURE_READ_BACK` flag.
+///
+/// @param[in] id Texture identifier.
+/// @param[in] callback Function receiving the content. The data pointer is
+///   valid only during the call.
+/// @param[in] user_data Pointer passed to the `callback`.
+///
+/// @returns Non-zero if the read was scheduled, zero if too many reads are in
+///   flight.
+///
+int read_texture_async(int id, void (* callback)(const void* data, int width, int height, void* user_data), void* user_data);
+
+/// Like `read_texture_async`, but for the content of the backbuffer.
+///
+int read_screen_async(void (* callback)(const void* data, int width, int height, void* user_data), void* user_data);
+
 /// Checks whether a texture or backbuffer content can be read back in current
 /// frame.
 ///
@@ -673,12 +1023,28 @@ void end_instancing(void);
 ///
 void instance(const void* data);
 
-/// Sets the active instance buffer which is used with next `mesh` call.
+/// Sets the active instance buffer which is used with next `mesh` call. Unless
+/// a custom shader is set, the instancing variant of the default one is used,
+/// applying the per-instance transform before the current model matrix. This
+/// only applies to `INSTANCE_TRANSFORM` buffers, the `INSTANCE_DATA_*` ones
+/// require a custom shader.
 ///
 /// @param[in] id Instance buffer identifier.
 ///
 void instances(int id);
 
+/// Creates an instance buffer directly from an array of tightly packed
+/// instance data, without the need for repeated `instance` calls. For
+/// `INSTANCE_TRANSFORM`, the data are expected to be column-major 4x4 float
+/// matrices. The same lifetime rules as with `begin_instancing` apply.
+///
+/// @param[in] id Instance buffer identifier.
+/// @param[in] type Instance buffer data type.
+/// @param[in] count Number of instances.
+/// @param[in] data Instance data.
+///
+void instances_from_array(int id, int type, int count, const void* data);
+
 
 // -----------------------------------------------------------------------------
 /// @section PASSES
@@ -751,6 +1117,78 @@ void viewport(int x, int y, int width, int height);
 ///
 void full_viewport(void);
 
+/// Enables dynamic resolution. The frame time is measured each frame, and the
+/// viewports of passes marked with `dynamic_resolution_pass` are scaled, so
+/// that the frame time stays around the target. Their framebuffers should stay
+/// full-size, and the final pass should upscale just the rendered region, by
+/// multiplying its texture coordinates with `resolution_scale`.
+///
+/// @param[in] target_ms Target frame time in milliseconds. Zero disables it.
+/// @param[in] min_scale Minimum viewport scale, in the (0, 1] range.
+/// @param[in] max_scale Maximum viewport scale, usually `1.0f`.
+///
+void dynamic_resolution(float target_ms, float min_scale, float max_scale);
+
+/// Marks whether the active pass' viewport is scaled by the dynamic resolution.
+/// Not scaled by default.
+///
+/// @param[in] enabled Non-zero to scale the viewport.
+///
+void dynamic_resolution_pass(int enabled);
+
+/// Returns current dynamic resolution scale, applied to marked passes'
+/// viewports. One, if the dynamic resolution is disabled.
+///
+/// @returns Viewport scale.
+///
+float resolution_scale(void);
+
+/// Enables or disables the render graph. With the graph, passes that declare
+/// their inputs and outputs (see `pass_reads`, `pass_writes` and
+/// `pass_output`) are culled if nothing visible depends on them, and reordered
+/// so that the ones rendering into the same framebuffer are grouped together.
+/// The declared dependencies follow the pass ID order, and passes rendering
+/// into the same framebuffer keep their relative order. Passes without any
+/// declaration are not affected. Disabled by default.
+///
+/// @param[in] enabled Non-zero to enable the render graph.
+///
+void render_graph(int enabled);
+
+/// Declares that the active pass samples given texture. Persistent across
+/// frames, until the pass is reset.
+///
+/// @param[in] texture Texture identifier.
+///
+void pass_reads(int texture);
+
+/// Declares that the active pass renders into given texture (typically an
+/// attachment of its framebuffer). Persistent across frames.
+///
+/// @param[in] texture Texture identifier.
+///
+void pass_writes(int texture);
+
+/// Marks the active pass as a graph output, so that it's never culled, even if
+/// it renders into a framebuffer (e.g., one that is read back). Passes without
+/// framebuffer are outputs implicitly.
+///
+void pass_output(void);
+
+/// Clears the active pass' render graph declarations.
+///
+void pass_reset_graph(void);
+
+/// Checks whether a pass was kept by the render graph in the last frame.
+/// Draws submitted into a culled pass are discarded, so expensive work can be
+/// skipped. Always non-zero, if the render graph is disabled.
+///
+/// @param[in] id Pass identifier.
+///
+/// @returns Non-zero if the pass is rendered.
+///
+int pass_active(int id);
+
 
 // -----------------------------------------------------------------------------
 /// @section FRAMEBUFFERS
@@ -803,11 +1241,24 @@ void create_uniform(int id, int type, int count, const char* name);
 
 /// Sets the uniform value which is used with next `mesh` call.
 ///
+/// The value is copied, so the passed memory can be reused right away. See
+/// `skip_redundant_uniforms` to avoid re-sending unchanged values.
+///
 /// @param[in] id Uniform identifier.
 /// @param[in] value Uniform data.
 ///
 void uniform(int id, const void* value);
 
+/// Enables skipping of uniform values identical to the ones bound by the
+/// previous draw with the same pass, shader and state. Only safe if no other
+/// thread draws into the passes the calling thread uses, as BGFX can order
+/// their draws in between. Affects the calling thread only. Disabled by
+/// default.
+///
+/// @param[in] enabled Non-zero to enable the skipping.
+///
+void skip_redundant_uniforms(int enabled);
+
 /// Creates a shader program. The shader data must be in specific format
 ///
 /// Using existing ID will result in destruction of the previously created data.
@@ -948,6 +1399,29 @@ void scale(float scale);
 ///
 void translate(float x, float y, float z);
 
+/// Transforms an array of points by the top of the active matrix stack
+/// (i.e., with W = 1, without perspective division). Very large arrays are
+/// split across the task pool.
+///
+/// @param[in] in Input points (XYZ triplets).
+/// @param[out] out Output points. Can be the same as `in`.
+/// @param[in] count Number of points.
+/// @param[in] stride Distance in bytes between consecutive points, both in
+///   `in` and `out`. Zero means tightly packed.
+///
+void transform_points(const float* in, float* out, int count, int stride);
+
+/// Transforms an array of directions by the top of the active matrix stack
+/// (i.e., with W = 0). The results are not normalized.
+///
+/// @param[in] in Input directions (XYZ triplets).
+/// @param[out] out Output directions. Can be the same as `in`.
+/// @param[in] count Number of directions.
+/// @param[in] stride Distance in bytes between consecutive directions, both
+///   in `in` and `out`. Zero means tightly packed.
+///
+void transform_directions(const float* in, float* out, int count, int stride);
+
 
 // -----------------------------------------------------------------------------
 /// @section MULTITHREADING
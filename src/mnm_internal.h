@@ -3,15 +3,31 @@
 #include <stdint.h>       // uint*_t
 
 #include <array>          // array
+#include <atomic>         // atomic
+#include <bitset>         // bitset
+#include <memory>         // unique_ptr
+#include <mutex>          // lock_guard, mutex
 #include <span>           // span
+#include <string>         // string
 #include <vector>         // vector
 
 #include <bgfx/bgfx.h>    // bgfx::*
 
+#include <bx/allocator.h> // DefaultAllocator
+#include <bx/bx.h>        // BX_CONCATENATE
+#include <bx/simd_t.h>    // simd128_t
+
 #include <GLFW/glfw3.h>   // GLFWwindow
 
 #include <HandmadeMath.h> // hmm_*
 
+namespace bimg
+{
+
+struct ImageContainer;
+
+} // namespace bimg
+
 namespace mnm
 {
 
@@ -21,14 +37,22 @@ namespace mnm
 
 // TODO : Ideally these are overridable by user via preprocessor directives. 
 
+constexpr uint32_t MAX_DRAW_LISTS         = 64;
+
+constexpr uint32_t MAX_INSTANCE_BUFFERS   = 32;
+
+constexpr uint32_t MAX_MATERIALS          = 128;
+
 constexpr uint32_t MAX_MATRIX_STACK_DEPTH = 16;
 
-constexpr uint32_t MAX_MESHES             = 2048;
+constexpr uint32_t MAX_MESHES             = 16384;
 
 constexpr uint32_t MAX_PASSES             = 48;
 
 constexpr uint32_t MAX_TEXTURES           = 512;
 
+constexpr uint32_t MAX_UNIFORMS           = 256;
+
 
 // -----------------------------------------------------------------------------
 // MEMORY ALLOCATION
@@ -59,6 +83,23 @@ struct PoolAllocator
     std::span<uint8_t> allocate(uint32_t count = 1);
 };
 
+struct Range
+{
+    uint32_t offset;
+    uint32_t size;
+};
+
+struct RangeAllocator
+{
+    std::vector<Range> free_ranges; // Sorted by offset.
+
+    void init(uint32_t capacity);
+
+    uint32_t allocate(uint32_t size);
+
+    void free(uint32_t offset, uint32_t size);
+};
+
 
 // -----------------------------------------------------------------------------
 // VERTEX LAYOUTS
@@ -120,56 +161,110 @@ enum struct MeshType
 struct MeshDesc
 {
     std::span<const uint8_t>  buffer;
+    std::span<const uint32_t> parts; // First vertex of each static batch part.
     const bgfx::VertexLayout* layout; 
     uint32_t                  flags;
 };
 
-union Mesh
+struct GeometryPage
 {
-    union
-    {
-        bgfx::TransientVertexBuffer* transient_vertex_buffer;
+    const bgfx::VertexLayout*       layout;
+    bgfx::DynamicVertexBufferHandle vertex_buffer;
+    bgfx::DynamicIndexBufferHandle  index_buffer;
+    RangeAllocator                  vertices;
+    RangeAllocator                  indices;
+};
 
-        struct
-        {
-            bgfx::VertexBufferHandle static_vertex_buffer;
-            bgfx::IndexBufferHandle  static_index_buffer;
-        };
-    };
+struct GeometryPool;
 
-    uint32_t                         flags;
-    uint16_t                         element_count;
+struct Mesh
+{
+    bgfx::TransientVertexBuffer*    transient_vertex_buffer;
+    bgfx::VertexBufferHandle        static_vertex_buffer;
+    bgfx::IndexBufferHandle         static_index_buffer;
+    bgfx::DynamicVertexBufferHandle pooled_vertex_buffer;
+    bgfx::DynamicIndexBufferHandle  pooled_index_buffer;
+    uint32_t                        base_vertex;
+    uint32_t                        first_index;
+    uint32_t                        vertex_count;
+    uint32_t                        flags;
+    uint32_t                        element_count;
+    hmm_vec3                        bounds_min;
+    hmm_vec3                        bounds_max;
+    uint16_t                        pool_page;
+    bool                            pooled;
 
     MeshType type() const;
 
     bool is_valid() const;
 
-    void create(const MeshDesc& desc, ArenaAllocator& allocator);
+    uint16_t vertex_buffer_index() const;
 
-    void destroy();
+    void create(const MeshDesc& desc, ArenaAllocator& allocator, GeometryPool& pool);
+
+    void destroy(GeometryPool& pool);
+
+    void bind(bgfx::Encoder& encoder, uint32_t element_start, uint32_t element_count) const;
+};
+
+struct GeometryPool
+{
+    std::mutex                       mutex;
+    std::vector<GeometryPage>        pages;
+    std::array<std::vector<Mesh>, 2> freed_meshes;
+
+    void init();
+
+    void cleanup();
+
+    void update();
+
+    bool allocate(const bgfx::VertexLayout& layout, const bgfx::Memory* vertices, const bgfx::Memory* indices, Mesh& mesh);
+
+    void free(const Mesh& mesh);
 };
 
 struct MeshCache
 {
-    std::array<Mesh, MAX_MESHES> meshes;
+    std::array<Mesh, MAX_MESHES>                  meshes;
+    std::array<std::vector<uint32_t>, MAX_MESHES> batch_parts;
+    std::array<std::vector<hmm_vec3>, MAX_MESHES> occluders; // Triangle lists.
+    GeometryPool                                  pool;
 
     void init();
 
     void cleanup();
 
-    void add_mesh(uint32_t id, const Mesh& mesh);
+    void add_mesh(uint32_t id, const Mesh& mesh, std::span<const uint32_t> parts = {});
+
+    void add_occluder(uint32_t id, const MeshDesc& desc);
+
+    bool get_batch_part(uint32_t id, uint32_t part, uint32_t& element_start, uint32_t& element_count) const;
 
     void invalidate_transient_meshes();
 };
 
+struct BatchRecorder
+{
+    std::vector<uint32_t> parts;
+
+    void reset();
+
+    void begin_part(const VertexRecorder& recorder);
+};
+
 
 // -----------------------------------------------------------------------------
 // DEFAULT PROGRAMS
 // -----------------------------------------------------------------------------
 
+// Internal flag selecting instancing variants of the default programs. Must not
+// collide with any of the public mesh flags.
+constexpr uint32_t INSTANCING_SUPPORTED = 0x0200;
+
 struct DefaultProgramCache
 {
-    std::array<bgfx::ProgramHandle, 8> programs;
+    std::array<bgfx::ProgramHandle, 16> programs;
 
     bgfx::ProgramHandle operator[](uint32_t flags) const;
 
@@ -200,17 +295,127 @@ struct DefaultUniformCache
 };
 
 
+// -----------------------------------------------------------------------------
+// UNIFORMS
+// -----------------------------------------------------------------------------
+
+struct Uniform
+{
+    bgfx::UniformHandle handle;
+    uint16_t            count;
+    uint16_t            size; // Of a single element.
+};
+
+struct UniformCache
+{
+    std::array<Uniform, MAX_UNIFORMS> uniforms;
+
+    void init();
+
+    void cleanup();
+
+    void add_uniform(uint32_t id, bgfx::UniformType::Enum type, uint16_t count, const char* name);
+};
+
+struct UniformValue
+{
+    bgfx::UniformHandle handle;
+    uint16_t            count;
+    uint32_t            size;
+    const void*         data;
+};
+
+struct UniformStaging
+{
+    std::vector<UniformValue>         pending;
+    std::vector<UniformValue>         last_values; // Indexed by handle.
+    std::vector<const bgfx::Encoder*> last_owners; // Encoders that set the last values.
+    std::vector<uint16_t>             touched;
+    const bgfx::Encoder*              encoder;
+    uint64_t                          state;
+    bgfx::ViewId                      pass;
+    bgfx::ProgramHandle               program;
+    bool                              skip_redundant; // Opt-in, see `skip_redundant_uniforms`.
+
+    void init();
+
+    void cleanup();
+
+    void reset();
+
+    void stage(ArenaAllocator& allocator, const Uniform& uniform, const void* value);
+
+    std::span<const UniformValue> take(ArenaAllocator& allocator);
+
+    void begin_draw(const bgfx::Encoder& encoder, bgfx::ViewId pass, bgfx::ProgramHandle program, uint64_t state);
+
+    void bind(bgfx::Encoder& encoder, std::span<const UniformValue> values);
+
+    void forget(bgfx::UniformHandle handle);
+};
+
+
+// -----------------------------------------------------------------------------
+// READBACK
+// -----------------------------------------------------------------------------
+
+// Enough to read every frame, as BGFX delivers the data two frames later.
+constexpr uint32_t READBACK_RING_SIZE = 3;
+
+using ReadbackCallback = void (*)(const void* data, int width, int height, void* user_data);
+
+using TaskQueueFunc = int (*)(void (* func)(void* data), void* data);
+
+struct ReadbackSlot
+{
+    bgfx::TextureHandle       blit_handle;
+    bgfx::TextureFormat::Enum format;
+    uint16_t                  width;
+    uint16_t                  height;
+    std::vector<uint8_t>      staging;
+    void*                     output_data;
+    ReadbackCallback          callback;
+    void*                     user_data;
+    uint32_t                  frame; // Frame in which the data is available.
+    std::atomic<bool>         busy;  // Until the callback returns.
+};
+
+// Each in-flight read uses its own blit texture, so reads can be scheduled
+// every frame, with a fixed latency.
+struct ReadbackRing
+{
+    std::array<ReadbackSlot, READBACK_RING_SIZE> slots;
+    uint32_t                                     next;
+
+    void init();
+
+    // Waits for the running callbacks.
+    void cleanup();
+
+    // Without `output_data`, the data is read into an internal buffer, only
+    // valid during the `callback`. Returns the frame in which the data is
+    // available, or `UINT32_MAX`, if all slots are in flight.
+    uint32_t schedule(bgfx::ViewId pass, bgfx::Encoder& encoder, bgfx::TextureHandle source, uint16_t width, uint16_t height, bgfx::TextureFormat::Enum format, void* output_data, ReadbackCallback callback, void* user_data);
+
+    // Callbacks of the finished reads are queued via `queue_task` (the public
+    // `task` function), or run directly if that fails.
+    void update(uint32_t frame, TaskQueueFunc queue_task);
+};
+
+
 // -----------------------------------------------------------------------------
 // TEXTURES
 // -----------------------------------------------------------------------------
 
 struct TextureDesc
 {
-    uint32_t    flags;
-    uint32_t    width;
-    uint32_t    height;
-    uint32_t    stride;
-    const void* data;
+    uint32_t        flags;
+    uint32_t        width;
+    uint32_t        height;
+    uint32_t        stride;
+    const void*     data;
+    bgfx::ReleaseFn release; // Called once the data is no longer needed.
+    void*           user_data;
 };
 
 struct Texture
@@ -220,19 +425,39 @@ struct Texture
     uint16_t                    height;
     bgfx::TextureFormat::Enum   format;
     bgfx::BackbufferRatio::Enum ratio;
-    bgfx::TextureHandle         blit_handle;
+    ReadbackRing*               readback;
     uint32_t                    read_frame;
+    uint32_t                    size;
+    bool                        placeholder;
+    bool                        evictable; // Has content the user can reload.
+    bool                        transient; // Handle owned by the pool.
 
     void create(const TextureDesc& desc, ArenaAllocator& allocator);
 
+    void create(bimg::ImageContainer* image, uint32_t flags);
+
     void destroy();
 
-    void schedule_read(bgfx::ViewId pass, bgfx::Encoder& encoder, void* output_data);
+    // Current size must be provided for backbuffer-size-related textures.
+    // Returns `false` if too many reads are in flight.
+    bool schedule_read(bgfx::ViewId pass, bgfx::Encoder& encoder, uint16_t current_width, uint16_t current_height, void* output_data, ReadbackCallback callback = nullptr, void* user_data = nullptr);
 };
 
+using TextureHook = void (*)(int id, void* user_data);
+
 struct TextureCache
 {
-    std::array<Texture, MAX_TEXTURES> textures;
+    std::array<Texture, MAX_TEXTURES>             textures;
+    std::array<std::atomic<bool>, MAX_TEXTURES>   evicted;
+    std::unique_ptr<std::atomic<uint32_t>[]>      last_used; // By BGFX handle.
+    std::unique_ptr<std::atomic<uint32_t>[]>      pins;      // By BGFX handle.
+    uint32_t                                      handle_count;
+    std::atomic<uint32_t>                         frame;
+    uint64_t                                      total_size;
+    uint64_t                                      budget;    // Zero if unlimited.
+    TextureHook                                   evicted_hook;
+    TextureHook                                   reload_hook;
+    void*                                         hook_user_data;
 
     Texture& operator[](uint32_t id);
 
@@ -241,6 +466,226 @@ struct TextureCache
     void cleanup();
 
     void add_texture(uint32_t id, const Texture& texture);
+
+    void touch(bgfx::TextureHandle handle);
+
+    // Pinned textures are never evicted. Used for the ones referenced by
+    // materials and draw lists, as those store the BGFX handles.
+    void pin(bgfx::TextureHandle handle);
+
+    void unpin(bgfx::TextureHandle handle);
+
+    // Evicts the least recently used textures, until the total size fits the
+    // budget. Meant to be called once per frame from the main thread.
+    void update(uint32_t frame);
+
+    // Returns `false` if the texture was evicted, in which case the reload hook
+    // is called (once per eviction).
+    bool request(uint32_t id);
+
+    void update_readbacks(uint32_t frame, TaskQueueFunc queue_task);
+};
+
+struct TextureUpdate
+{
+    uint8_t* data; // Tightly packed.
+    uint32_t id;
+    uint32_t format_size;
+    uint16_t x;
+    uint16_t y;
+    uint16_t width;
+    uint16_t height;
+};
+
+// Sub-region updates are staged in the frame memory, and coalesced before the
+// upload, if the regions are contained in each other, or share a whole edge.
+struct TextureUpdateQueue
+{
+    std::mutex                 mutex;
+    std::vector<TextureUpdate> updates;
+    std::vector<TextureUpdate> coalesced;
+
+    void init();
+
+    void cleanup();
+
+    void add(uint32_t id, const Texture& texture, uint16_t x, uint16_t y, uint16_t width, uint16_t height, uint32_t stride, const void* data, ArenaAllocator& frame_allocator);
+
+    // Meant to be called once per frame from the main thread.
+    void flush(TextureCache& textures, ArenaAllocator& frame_allocator);
+};
+
+struct SkylineNode
+{
+    uint16_t x;
+    uint16_t y;
+    uint16_t width;
+};
+
+// Skyline bottom-left rectangle packer. Individual rectangles can't be freed,
+// only the whole atlas can be reset.
+struct TextureAtlas
+{
+    std::vector<SkylineNode> skyline;
+    uint16_t                 width;
+    uint16_t                 height;
+
+    void reset(uint16_t width, uint16_t height);
+
+    bool pack(uint16_t width, uint16_t height, uint16_t& out_x, uint16_t& out_y);
+};
+
+struct TextureAtlasCache
+{
+    std::mutex                             mutex;
+    std::array<TextureAtlas, MAX_TEXTURES> atlases;
+
+    void init();
+
+    void cleanup();
+
+    void reset(uint32_t id, uint16_t width, uint16_t height);
+
+    // Packs and uploads the image, with its edge pixels extruded into the
+    // padding. Returns `false` if it doesn't fit. Otherwise, `out_uv` is set
+    // to left, top, right and bottom texture coordinates.
+    bool add_image(uint32_t id, const Texture& texture, uint16_t width, uint16_t height, uint32_t stride, const void* data, TextureUpdateQueue& updates, ArenaAllocator& frame_allocator, float* out_uv);
+};
+
+struct TransientTarget
+{
+    Texture  texture;
+    uint32_t flags;
+    uint16_t width;     // Can be one of `SIZE_*` values.
+    uint16_t height;
+    uint64_t pass_mask; // Passes using it in the current frame.
+    uint32_t last_frame;
+};
+
+// Frame-scoped render target textures. Requests with the same flags and size
+// share a texture, if their pass ranges don't overlap. Backbuffer-size-related
+// textures are resized by BGFX, so they're never re-created. The ranges are in
+// pass ID order, so aliasing must be disabled when the passes are reordered
+// by the render graph (compiled only after all the requests in the frame).
+struct TransientTargetPool
+{
+    std::mutex                   mutex;
+    std::vector<TransientTarget> targets;
+    uint32_t                     frame;
+
+    void init();
+
+    void cleanup();
+
+    // Returns a non-owning copy, usable for the rest of the current frame.
+    Texture acquire(uint32_t flags, uint16_t width, uint16_t height, bgfx::ViewId first_pass, bgfx::ViewId last_pass, bool alias, ArenaAllocator& frame_allocator);
+
+    // Starts a new frame, and destroys the targets not used in a while. Meant
+    // to be called once per frame from the main thread.
+    void update(uint32_t frame);
+};
+
+// Block-compresses RGBA8 content on the CPU. Results are stored in the cache
+// directory (if set), under the hash of the source content, so that the slow
+// encoding runs only once.
+struct TextureCompressor
+{
+    std::string          cache_dir;
+    bx::DefaultAllocator allocator;
+
+    void init();
+
+    void cleanup();
+
+    // Thread-safe, except for the `cache_dir` change. Returns `nullptr` if no
+    // compression is requested by the flags.
+    bimg::ImageContainer* compress(const void* data, uint32_t width, uint32_t height, uint32_t stride, uint32_t flags);
+};
+
+struct TextureStreamer;
+
+struct TextureRequest
+{
+    TextureStreamer*      streamer;
+    TextureCompressor*    compressor;
+    bimg::ImageContainer* image;
+    std::string           path;
+    uint32_t              id;
+    uint32_t              flags;
+    uint32_t              generation;
+};
+
+struct TextureStreamer
+{
+    std::mutex                               mutex;
+    std::array<TextureRequest, MAX_TEXTURES> requests;
+    std::vector<TextureRequest*>             free_requests;
+    std::vector<TextureRequest*>             decoded;
+    std::array<uint32_t, MAX_TEXTURES>       generations;
+    std::atomic<uint32_t>                    in_flight; // Requested, but not completed yet.
+
+    void init();
+
+    void cleanup();
+
+    // Returns `nullptr` if all the requests are in flight. Otherwise, the
+    // request has to be passed to `decode_texture_task`.
+    TextureRequest* request(uint32_t id, uint32_t flags, const char* path, TextureCache& textures, TextureCompressor& compressor, ArenaAllocator& frame_allocator);
+
+    void cancel(uint32_t id);
+
+    void complete(TextureRequest* request);
+
+    void update(TextureCache& textures);
+};
+
+// Decodes an image file contents, and builds mips or compresses it, as
+// requested by the flags. Thread-safe.
+bimg::ImageContainer* decode_texture(const void* data, uint32_t size, uint32_t flags, TextureCompressor& compressor);
+
+// Reads and decodes the requested image file. Signature compatible with the
+// public `task` function, with `TextureRequest` payload. Can also be called
+// directly, if the task couldn't be queued.
+void decode_texture_task(void* data);
+
+
+// -----------------------------------------------------------------------------
+// INSTANCING
+// -----------------------------------------------------------------------------
+
+struct InstanceRecorder
+{
+    PoolAllocator allocator;
+    uint32_t      instance_count;
+    uint32_t      instance_size;
+    bool          is_transform;
+
+    void reset(uint32_t type, std::span<uint8_t> buffer);
+
+    void push_instance(const hmm_mat4& transform, const void* data);
+
+    std::span<const uint8_t> buffer() const;
+};
+
+struct InstanceBuffer
+{
+    bgfx::InstanceDataBuffer buffer;
+    bool                     is_transform;
+
+    bool is_valid() const;
+
+    void create(uint32_t type, std::span<const uint8_t> data);
+};
+
+struct InstanceCache
+{
+    std::array<InstanceBuffer, MAX_INSTANCE_BUFFERS> buffers;
+
+    void init();
+
+    void add_buffer(uint32_t id, const InstanceBuffer& buffer);
+
+    void invalidate();
 };
 
 
@@ -251,8 +696,11 @@ struct TextureCache
 struct MatrixStack
 {
     hmm_mat4                                     top;
+    uint32_t                                     top_id;
+    uint32_t                                     last_id;
     uint32_t                                     size;
     std::array<hmm_mat4, MAX_MATRIX_STACK_DEPTH> matrices;
+    std::array<uint32_t, MAX_MATRIX_STACK_DEPTH> ids;
 
     void init();
 
@@ -260,9 +708,131 @@ struct MatrixStack
 
     void pop();
 
+    void set_top(const hmm_mat4& matrix);
+
+    // All the following pre-multiply the top matrix (`top = matrix * top`).
     void multiply_top(const hmm_mat4& matrix);
+
+    void translate(const hmm_vec3& offset);
+
+    void scale(const hmm_vec3& factor);
+
+    // Angle in degrees, as in `HMM_Rotate`.
+    void rotate(float angle, const hmm_vec3& axis);
+};
+
+// SIMD `out = a * b`. The `out` can be the same as `b`. All matrices have to be
+// 16-byte aligned.
+void multiply_matrices(const hmm_mat4& a, const hmm_mat4& b, hmm_mat4& out);
+
+
+// -----------------------------------------------------------------------------
+// VECTOR TRANSFORMS
+// -----------------------------------------------------------------------------
+
+// Transforms `count` XYZ triplets, `stride` bytes apart, by `matrix` with the
+// given W (1 for points, 0 for directions). Can be done in place.
+void transform_vectors(const hmm_mat4& matrix, float w, const void* in, void* out, uint32_t count, uint32_t stride);
+
+struct TransformTask
+{
+    hmm_mat4              matrix;
+    float                 w;
+    const uint8_t*        in;
+    uint8_t*              out;
+    uint32_t              count;
+    uint32_t              stride;
+    uint32_t              chunk_count;
+    std::atomic<uint32_t> next_chunk;
+    std::atomic<uint32_t> done_chunks;
+    std::atomic<uint32_t> references; // Caller and each queued task.
+};
+
+// Signature compatible with the public `task` function.
+void transform_vectors_task(void* data);
+
+// Large arrays are split into chunks, claimed by both the calling thread and
+// the tasks added via `queue_task` (can be null). Returns when all are done.
+// Zero `stride` means tightly packed triplets.
+void transform_vectors_parallel(const hmm_mat4& matrix, float w, const void* in, void* out, uint32_t count, uint32_t stride, TaskQueueFunc queue_task);
+
+
+// -----------------------------------------------------------------------------
+// TRANSFORM CACHE
+// -----------------------------------------------------------------------------
+
+struct CachedTransform
+{
+    uint32_t matrix_id;
+    uint32_t index;
+};
+
+struct TransformCache
+{
+    std::array<CachedTransform, 64> entries;
+
+    void reset();
+
+    uint32_t add(bgfx::Encoder& encoder, const hmm_mat4* matrices, uint16_t count);
+
+    uint32_t get(bgfx::Encoder& encoder, const MatrixStack& stack);
+};
+
+
+// -----------------------------------------------------------------------------
+// OCCLUSION CULLING
+// -----------------------------------------------------------------------------
+
+constexpr uint32_t OCCLUSION_BUFFER_WIDTH  = 256;
+
+constexpr uint32_t OCCLUSION_BUFFER_HEIGHT = 128;
+
+constexpr uint32_t OCCLUSION_TILE_SIZE     = 8;
+
+constexpr uint32_t OCCLUSION_BAND_COUNT    = 8;
+
+struct Occluder
+{
+    hmm_mat4                     transform;
+    const std::vector<hmm_vec3>* triangles;
+};
+
+struct OcclusionBuffer
+{
+    std::mutex                    mutex;
+    std::vector<Occluder>         occluders;
+    std::vector<hmm_vec4>         screen_vertices;
+    std::vector<bx::simd128_t>    depth;      // Four pixels per item.
+    std::vector<float>            tile_depth; // Farthest depth per tile.
+    hmm_mat4                      view_proj;
+    std::atomic<uint32_t>         pending_bands;
+    std::atomic<bgfx::ViewId>     pass;  // Read by any thread in `mesh` calls.
+    std::atomic<bool>             ready;
+
+    void init();
+
+    void cleanup();
+
+    void begin(bgfx::ViewId pass, const hmm_mat4& view_proj);
+
+    void add_occluder(const hmm_mat4& transform, const std::vector<hmm_vec3>& triangles);
+
+    void end();
+
+    void rasterize(uint32_t band);
+
+    bool is_visible(const hmm_mat4& transform, const hmm_vec3& bounds_min, const hmm_vec3& bounds_max) const;
 };
 
+struct OcclusionTask
+{
+    OcclusionBuffer* buffer;
+    uint32_t         band;
+};
+
+// Signature compatible with the public `task` function.
+void rasterize_occlusion_band(void* data);
+
 
 // -----------------------------------------------------------------------------
 // PASSES
@@ -297,10 +867,19 @@ struct Pass
 
     uint8_t                 dirty_flags;
 
+    float                   resolution_scale;
+
+    // Render graph declarations (texture IDs).
+    std::bitset<MAX_TEXTURES> reads;
+    std::bitset<MAX_TEXTURES> writes;
+    bool                      output;
+
     void init();
 
     void update(bgfx::ViewId id, bool backbuffer_size_changed);
 
+    bool in_graph() const;
+
     void touch();
 
     void set_view(const hmm_mat4& matrix);
@@ -316,18 +895,41 @@ struct Pass
     void set_clear_color(uint32_t rgba);
 
     void set_viewport(uint16_t x, uint16_t y, uint16_t width, uint16_t height);
+
+    // Scales the viewport size, keeping its origin.
+    void set_resolution_scale(float scale);
 };
 
+// Optional render graph over the passes with declared texture reads and
+// writes. Passes not contributing to any output (backbuffer or explicitly
+// marked) are culled, and the rest are reordered, so that passes sharing
+// a framebuffer run next to each other. Dependencies follow the pass ID order,
+// passes on the same framebuffer never swap, and the passes outside of the
+// graph keep their position.
 struct PassCache
 {
-    std::array<Pass, MAX_PASSES> passes;
-    bool                         backbuffer_size_changed;
+    static_assert(MAX_PASSES <= 64, "Pass masks must fit 64 bits.");
+
+    std::array<Pass, MAX_PASSES>         passes;
+    std::array<bgfx::ViewId, MAX_PASSES> order;
+    uint64_t                             active_mask;
+    bool                                 backbuffer_size_changed;
+    bool                                 graph_enabled;
+    bool                                 order_changed;
 
     Pass& operator[](bgfx::ViewId id);
 
     void init();
 
     void update();
+
+    void enable_graph(bool enabled);
+
+    bool is_active(bgfx::ViewId id) const;
+
+    void set_resolution_scale(uint64_t pass_mask, float scale);
+
+    void compile_graph();
 };
 
 
@@ -350,26 +952,234 @@ struct Timer
 };
 
 
+// -----------------------------------------------------------------------------
+// PROFILER
+// -----------------------------------------------------------------------------
+
+constexpr uint32_t PROFILER_RING_SIZE   = 16384; // Power of two.
+
+constexpr uint32_t PROFILER_MAX_DEPTH   = 32;
+
+constexpr uint32_t PROFILER_MAX_THREADS = 64;
+
+struct ProfilerZone
+{
+    const char* name; // Has to stay valid until the trace is dumped.
+    int64_t     start;
+    int64_t     end;
+};
+
+// Written only by its own thread. Finished zones go into the ring, which only
+// keeps the most recent ones.
+struct ProfilerThread
+{
+    std::array<ProfilerZone, PROFILER_RING_SIZE> zones;
+    std::array<ProfilerZone, PROFILER_MAX_DEPTH> open_zones;
+    std::atomic<uint32_t>                        head;
+    uint32_t                                     depth;
+    uint32_t                                     id;
+};
+
+struct Profiler
+{
+    std::array<std::atomic<ProfilerThread*>, PROFILER_MAX_THREADS> threads;
+    std::atomic<uint32_t>                                          thread_count;
+    std::atomic<uint32_t>                                          generation; // Invalidates per-thread pointers.
+    std::atomic<bool>                                              enabled;
+
+    // Only once no other thread records anymore.
+    void cleanup();
+
+    void begin_zone(const char* name);
+
+    void end_zone();
+
+    bool dump(const char* path);
+
+    ProfilerThread* current_thread();
+};
+
+// Process-wide, so that any part of the library can be instrumented.
+extern Profiler g_profiler;
+
+struct ProfilerScope
+{
+    explicit ProfilerScope(const char* name)
+    {
+        g_profiler.begin_zone(name);
+    }
+
+    ~ProfilerScope()
+    {
+        g_profiler.end_zone();
+    }
+};
+
+#define PROFILE_ZONE(name) ::mnm::ProfilerScope BX_CONCATENATE(profiler_scope_, __LINE__)(name)
+
+
+// -----------------------------------------------------------------------------
+// DYNAMIC RESOLUTION
+// -----------------------------------------------------------------------------
+
+// Scales the viewports of the selected passes, so that the (smoothed) frame
+// time stays around the target. Scale goes down quickly, and up slowly, with
+// no change within the tolerance band or shortly after previous change.
+struct DynamicResolution
+{
+    Timer    timer;
+    double   target_time;  // Zero if disabled.
+    double   average_time;
+    float    min_scale;
+    float    max_scale;
+    float    scale;
+    uint32_t cooldown;
+    uint64_t pass_mask;
+
+    void init();
+
+    void configure(double target_time, float min_scale, float max_scale);
+
+    // Meant to be called once per frame. Returns `true` if the scale changed.
+    bool update();
+};
+
+
+// -----------------------------------------------------------------------------
+// MATERIALS
+// -----------------------------------------------------------------------------
+
+struct DrawState;
+
+struct MaterialUniform
+{
+    bgfx::UniformHandle handle;
+    uint16_t            count;
+    uint32_t            offset;
+};
+
+struct Material
+{
+    std::vector<MaterialUniform> uniforms;
+    std::vector<uint8_t>         values;
+    uint64_t                     state;
+    bgfx::ProgramHandle          program;
+    bgfx::TextureHandle          texture;
+    bgfx::UniformHandle          sampler;
+
+    void create(const DrawState& draw_state);
+
+    void add_uniform(bgfx::UniformHandle handle, const void* value, uint16_t count, uint32_t size);
+
+    void bind_uniforms(bgfx::Encoder& encoder, UniformStaging& staging) const;
+};
+
+struct MaterialCache
+{
+    std::array<Material, MAX_MATERIALS> materials;
+
+    void init();
+
+    void cleanup();
+
+    void add_material(uint32_t id, Material& material, TextureCache& textures);
+};
+
+
 // -----------------------------------------------------------------------------
 // DRAW STATE & SUBMISSION
 // -----------------------------------------------------------------------------
 
+struct DrawRecord
+{
+    hmm_mat4                        transform;
+    const Mesh*                     mesh;
+    const bgfx::InstanceDataBuffer* instances;
+    const Material*                 material;
+    std::span<const UniformValue>   uniforms;
+    uint64_t                        state;
+    uint32_t                        transform_index;
+    uint32_t                        element_start;
+    uint32_t                        element_count;
+    bgfx::ViewId                    pass;
+    bgfx::ProgramHandle             program;
+    bgfx::TextureHandle             texture;
+    bgfx::UniformHandle             sampler;
+
+    bool shares_geometry(const DrawRecord& other) const;
+
+    bool shares_texture(const DrawRecord& other) const;
+
+    void submit(bgfx::Encoder& encoder, UniformStaging& staging, TextureCache& textures, const DrawRecord* previous, const DrawRecord* next, uint32_t parent_transform_index = UINT32_MAX) const;
+};
+
+struct DeferredDrawQueue
+{
+    std::vector<uint64_t>    keys;
+    std::vector<DrawRecord*> records;
+    std::vector<uint64_t>    temp_keys;
+    std::vector<DrawRecord*> temp_records;
+    bool                     enabled;
+
+    void init();
+
+    void cleanup();
+
+    void push(DrawRecord* record, float depth);
+
+    void flush(bgfx::Encoder& encoder, UniformStaging& staging, TextureCache& textures, const DefaultProgramCache& default_programs);
+};
+
+struct DrawList
+{
+    std::vector<DrawRecord> records;
+
+    void submit(bgfx::Encoder& encoder, UniformStaging& staging, TextureCache& textures, const hmm_mat4* parent) const;
+};
+
+struct DrawListCache
+{
+    std::array<DrawList, MAX_DRAW_LISTS> lists;
+
+    void init();
+
+    void cleanup();
+
+    void add_list(uint32_t id, DrawList& list, TextureCache& textures);
+};
+
 struct DrawState
 {
-    const Mesh*             mesh;
-    const hmm_mat4*         transform;
-    uint32_t                element_start;
-    uint32_t                element_count;
-    uint32_t                flags;
-    bgfx::ViewId            pass;
-    bgfx::FrameBufferHandle framebuffer;
-    bgfx::ProgramHandle     program;
-    bgfx::TextureHandle     texture;
-    bgfx::UniformHandle     sampler;
+    const Mesh*                   mesh;
+    const hmm_mat4*               transform;
+    const InstanceBuffer*         instances;
+    const Material*               material;
+    std::span<const UniformValue> uniforms;
+    uint32_t                      transform_index;
+    uint32_t                      element_start;
+    uint32_t                      element_count;
+    uint32_t                      flags;
+    bgfx::ViewId                  pass;
+    bgfx::FrameBufferHandle       framebuffer;
+    bgfx::ProgramHandle           program;
+    bgfx::TextureHandle           texture;
+    bgfx::UniformHandle           sampler;
 
     void reset();
 
-    void submit(bgfx::Encoder& encoder);
+    void submit(bgfx::Encoder& encoder, UniformStaging& staging, TextureCache& textures, const DefaultProgramCache& default_programs);
+
+    void submit(DeferredDrawQueue& queue, ArenaAllocator& allocator, const hmm_mat4& view_matrix, const DefaultProgramCache& default_programs);
+
+    void submit(DrawList& list, const DefaultProgramCache& default_programs);
+
+    void fill(DrawRecord& record, const DefaultProgramCache& default_programs) const;
+
+    // Material's or the set program, with the default one replaced by its
+    // instancing variant for transform instance buffers.
+    bgfx::ProgramHandle select_program(const DefaultProgramCache& default_programs) const;
+
+    bool is_visible(const OcclusionBuffer& occlusion) const;
 };
 
 
@@ -389,7 +1199,13 @@ struct ThreadLocalContext
     std::vector<uint8_t> double_frame_memory;
     ArenaAllocator       frame_allocator;
     DrawState            draw_state;
+    DeferredDrawQueue    draw_queue;
+    DrawList             draw_list_recorder;
+    InstanceRecorder     instance_recorder;
+    BatchRecorder        batch_recorder;
     MatrixStack          matrix_stack;
+    TransformCache       transform_cache;
+    UniformStaging       uniform_staging;
 
     void init(uint32_t frame_memory);
 
@@ -405,14 +1221,26 @@ struct ThreadLocalContext
 
 struct GlobalContext
 {
+    DrawListCache       draw_lists;
+    DynamicResolution   dynamic_resolution;
+    MaterialCache       materials;
     MeshCache           meshes;
     PassCache           passes;
+    TextureCompressor   texture_compressor;
     VertexLayoutCache   vertex_layouts;
 
     // These ones require BGFX to be set up.
     DefaultUniformCache default_uniforms;
     DefaultProgramCache default_programs;
+    InstanceCache       instances;
+    OcclusionBuffer     occlusion;
+    TextureAtlasCache   texture_atlases;
     TextureCache        textures;
+    TextureStreamer     texture_streamer;
+    TransientTargetPool transient_targets;
+    TextureUpdateQueue  texture_updates;
+    UniformCache        uniforms;
+    ReadbackRing        screen_readback;
 
     void init();
 
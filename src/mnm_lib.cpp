@@ -1,13 +1,26 @@
 #include "mnm_internal.h"
 
+#include <float.h>                // FLT_MAX
 #include <inttypes.h>             // PRI*
 #include <stddef.h>               // max_align_t, size_t
+#include <stdio.h>                // fclose, ferror, fopen, fprintf, fputc, fputs, fread, fseek, ftell, fwrite, remove, rename, snprintf
 #include <string.h>               // memcpy
 
+#include <algorithm>              // sort
+#include <thread>                 // this_thread
+#include <utility>                // move
+
 #include <bgfx/embedded_shader.h> // BGFX_EMBEDDED_SHADER
 
+#include <bimg/bimg.h>            // imageAlloc, imageConvert, imageFree, imageGetRawData, isCompressed, ImageContainer
+#include <bimg/decode.h>          // imageParse
+#include <bimg/encode.h>          // imageEncodeFromRgba8
+
 #include <bx/allocator.h>         // alignPtr
-#include <bx/bx.h>                // BX_ASSERT, BX_WARN, isPowerOf2
+#include <bx/bx.h>                // BX_ASSERT, BX_WARN, isPowerOf2, max, min, swap
+#include <bx/math.h>              // round, sqrt
+#include <bx/simd_t.h>            // simd_*, simd128_t
+#include <bx/sort.h>              // radixSort
 #include <bx/timer.h>             // getHPCounter, getHPFrequency
 
 #include <meshoptimizer.h>        // meshopt_*
@@ -130,6 +143,69 @@ std::span<uint8_t> PoolAllocator::allocate(uint32_t count)
     return {};
 }
 
+void RangeAllocator::init(uint32_t capacity)
+{
+    free_ranges.clear();
+    free_ranges.push_back({ 0, capacity });
+}
+
+uint32_t RangeAllocator::allocate(uint32_t size)
+{
+    for (size_t i = 0; i < free_ranges.size(); i++)
+    {
+        Range& range = free_ranges[i];
+
+        if (range.size >= size)
+        {
+            const uint32_t offset = range.offset;
+
+            range.offset += size;
+            range.size   -= size;
+
+            if (range.size == 0)
+            {
+                free_ranges.erase(free_ranges.begin() + i);
+            }
+
+            return offset;
+        }
+    }
+
+    return UINT32_MAX;
+}
+
+void RangeAllocator::free(uint32_t offset, uint32_t size)
+{
+    size_t i = 0;
+
+    while (i < free_ranges.size() && free_ranges[i].offset < offset)
+    {
+        i++;
+    }
+
+    const bool merge_prev = i > 0                  && free_ranges[i - 1].offset + free_ranges[i - 1].size == offset;
+    const bool merge_next = i < free_ranges.size() && offset + size == free_ranges[i].offset;
+
+    if (merge_prev && merge_next)
+    {
+        free_ranges[i - 1].size += size + free_ranges[i].size;
+        free_ranges.erase(free_ranges.begin() + i);
+    }
+    else if (merge_prev)
+    {
+        free_ranges[i - 1].size += size;
+    }
+    else if (merge_next)
+    {
+        free_ranges[i].offset  = offset;
+        free_ranges[i].size   += size;
+    }
+    else
+    {
+        free_ranges.insert(free_ranges.begin() + i, { offset, size });
+    }
+}
+
 template <typename T>
 void allocate(T*& ptr, ArenaAllocator& allocator, uint32_t count = 1)
 {
@@ -318,20 +394,56 @@ bool Mesh::is_valid() const
     return element_count > 0;
 }
 
-void Mesh::create(const MeshDesc& desc, ArenaAllocator& allocator)
+uint16_t Mesh::vertex_buffer_index() const
+{
+    if (transient_vertex_buffer)
+    {
+        return transient_vertex_buffer->handle.idx;
+    }
+
+    return pooled ? pooled_vertex_buffer.idx : static_vertex_buffer.idx;
+}
+
+// Position is always the first vertex attribute.
+static hmm_vec3 read_vertex_position(const uint8_t* vertex)
+{
+    hmm_vec3 position;
+    memcpy(&position, vertex, sizeof(position));
+
+    return position;
+}
+
+void Mesh::create(const MeshDesc& desc, ArenaAllocator& allocator, GeometryPool& pool)
 {
+    PROFILE_ZONE("Mesh::create");
+
     *this = {};
 
     const uint32_t vertex_size  = desc.layout->getStride();
     const uint32_t vertex_count = desc.buffer.size() / vertex_size;
-    REQUIRE(
-        vertex_count < UINT16_MAX,
-        "Too many vertices (%" PRIu32 ").",
-        vertex_count
-    );
+
+    bounds_min = HMM_Vec3( FLT_MAX,  FLT_MAX,  FLT_MAX);
+    bounds_max = HMM_Vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+    for (uint32_t i = 0; i < vertex_count; i++)
+    {
+        const hmm_vec3 position = read_vertex_position(desc.buffer.data() + i * vertex_size);
+
+        for (int j = 0; j < 3; j++)
+        {
+            bounds_min.Elements[j] = bx::min(bounds_min.Elements[j], position.Elements[j]);
+            bounds_max.Elements[j] = bx::max(bounds_max.Elements[j], position.Elements[j]);
+        }
+    }
 
     if (desc.flags & MESH_TRANSIENT)
     {
+        REQUIRE(
+            vertex_count < UINT16_MAX,
+            "Too many vertices (%" PRIu32 ").",
+            vertex_count
+        );
+
         bgfx::TransientVertexBuffer* buffer;
         allocate(buffer, allocator);
         REQUIRE(
@@ -377,7 +489,7 @@ void Mesh::create(const MeshDesc& desc, ArenaAllocator& allocator)
         vertex_size
     ));
 
-    const bgfx::Memory* indices = allocacte_bgfx_memory(allocator, indexed_vertex_count * vertex_size);
+    const bgfx::Memory* indices = allocacte_bgfx_memory(allocator, index_count * sizeof(uint32_t));
     REQUIRE(
         indices && indices->data,
         "Failed to allocate remapped index buffer memory."
@@ -401,21 +513,51 @@ void Mesh::create(const MeshDesc& desc, ArenaAllocator& allocator)
 
     if (optimize_geometry)
     {
-        meshopt_optimizeVertexCache(indices_u32, indices_u32, index_count, indexed_vertex_count);
+        // Static batch parts are optimized separately, so that their element
+        // ranges stay intact (the vertex fetch optimization only reorders the
+        // vertices).
+        const uint32_t part_count = bx::max(uint32_t(desc.parts.size()), 1u);
+
+        for (uint32_t i = 0; i < part_count; i++)
+        {
+            const uint32_t start = i     < desc.parts.size() ? desc.parts[i    ] : 0;
+            const uint32_t end   = i + 1 < desc.parts.size() ? desc.parts[i + 1] : index_count;
+
+            uint32_t* part_indices = indices_u32 + start;
 
-        meshopt_optimizeOverdraw(indices_u32, indices_u32, index_count, reinterpret_cast<float*>(vertices->data), indexed_vertex_count, vertex_size, 1.05f);
+            meshopt_optimizeVertexCache(part_indices, part_indices, end - start, indexed_vertex_count);
+
+            meshopt_optimizeOverdraw(part_indices, part_indices, end - start, reinterpret_cast<float*>(vertices->data), indexed_vertex_count, vertex_size, 1.05f);
+        }
 
         meshopt_optimizeVertexFetch(vertices->data, indices_u32, index_count, vertices->data, indexed_vertex_count, vertex_size);
     }
 
-    uint16_t* indices_u16 = reinterpret_cast<uint16_t*>(indices->data);
+    // Large meshes (e.g., static batches) keep 32-bit indices.
+    const bool index32 = indexed_vertex_count > UINT16_MAX;
 
-    for (uint32_t i = 0; i < index_count; i++)
+    if (!index32)
     {
-        indices_u16[i] = uint16_t(indices_u32[i]);
+        uint16_t* indices_u16 = reinterpret_cast<uint16_t*>(indices->data);
+
+        for (uint32_t i = 0; i < index_count; i++)
+        {
+            indices_u16[i] = uint16_t(indices_u32[i]);
+        }
+
+        const_cast<bgfx::Memory*>(indices)->size /= 2;
     }
 
-    const_cast<bgfx::Memory*>(indices)->size /= 2;
+    // NOTE : The local vertex count is the one before remapping.
+    flags              = desc.flags;
+    element_count      = index_count;
+    this->vertex_count = indexed_vertex_count;
+
+    // Meshes with 16-bit indices are suballocated from the shared buffers.
+    if (!index32 && pool.allocate(*desc.layout, vertices, indices, *this))
+    {
+        return;
+    }
 
     static_vertex_buffer = bgfx::createVertexBuffer(vertices, *desc.layout);
     REQUIRE(
@@ -423,51 +565,306 @@ void Mesh::create(const MeshDesc& desc, ArenaAllocator& allocator)
         "Failed to create BGFX vertex buffer."
     );
 
-    static_index_buffer = bgfx::createIndexBuffer(indices);
+    static_index_buffer = bgfx::createIndexBuffer(indices, index32 ? BGFX_BUFFER_INDEX32 : BGFX_BUFFER_NONE);
     REQUIRE(
         bgfx::isValid(static_index_buffer),
         "Failed to create BGFX index buffer."
     );
-
-    flags = desc.flags;
-    element_count = uint16_t(index_count);
 }
 
-void Mesh::destroy()
+void Mesh::destroy(GeometryPool& pool)
 {
     if (element_count && !transient_vertex_buffer)
     {
-        bgfx::destroy(static_vertex_buffer);
-        bgfx::destroy(static_index_buffer );
+        if (pooled)
+        {
+            pool.free(*this);
+        }
+        else
+        {
+            bgfx::destroy(static_vertex_buffer);
+            bgfx::destroy(static_index_buffer );
+        }
     }
 
     *this = {};
 }
 
+void Mesh::bind(bgfx::Encoder& encoder, uint32_t element_start, uint32_t element_count_) const
+{
+    ASSERT(
+        element_start <= element_count,
+        "Element start %" PRIu32 " out of range (%" PRIu32 " elements).",
+        element_start, element_count
+    );
+
+    element_start  = bx::min(element_start , element_count                );
+    element_count_ = bx::min(element_count_, element_count - element_start);
+
+    if (transient_vertex_buffer)
+    {
+        encoder.setVertexBuffer(0, transient_vertex_buffer, element_start, element_count_);
+    }
+    else if (pooled)
+    {
+        // NOTE : The start vertex acts as the base vertex of indexed draws.
+        encoder.setVertexBuffer(0, pooled_vertex_buffer, base_vertex, vertex_count);
+        encoder.setIndexBuffer (   pooled_index_buffer , first_index + element_start, element_count_);
+    }
+    else
+    {
+        encoder.setVertexBuffer(0, static_vertex_buffer);
+        encoder.setIndexBuffer (   static_index_buffer, element_start, element_count_);
+    }
+}
+
+// Dynamic buffers shared by the static meshes of the same vertex layout.
+static constexpr uint32_t GEOMETRY_PAGE_VERTICES = 1 << 18;
+static constexpr uint32_t GEOMETRY_PAGE_INDICES  = 1 << 20;
+
+void GeometryPool::init()
+{
+    // NOTE : Pages are created lazily, as BGFX might not be initialized yet.
+    pages.clear();
+
+    freed_meshes[0].clear();
+    freed_meshes[1].clear();
+}
+
+void GeometryPool::cleanup()
+{
+    for (GeometryPage& page : pages)
+    {
+        bgfx::destroy(page.vertex_buffer);
+        bgfx::destroy(page.index_buffer );
+    }
+
+    std::vector<GeometryPage>().swap(pages);
+
+    std::vector<Mesh>().swap(freed_meshes[0]);
+    std::vector<Mesh>().swap(freed_meshes[1]);
+}
+
+void GeometryPool::update()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // Ranges are only reused two frames after being freed, as the meshes might
+    // still be drawn in the frame being rendered.
+    for (const Mesh& mesh : freed_meshes[1])
+    {
+        GeometryPage& page = pages[mesh.pool_page];
+
+        page.vertices.free(mesh.base_vertex, mesh.vertex_count );
+        page.indices .free(mesh.first_index, mesh.element_count);
+    }
+
+    freed_meshes[1].clear();
+    freed_meshes[0].swap(freed_meshes[1]);
+}
+
+static bool allocate_from_page(GeometryPage& page, uint32_t vertex_count, uint32_t index_count, Mesh& mesh)
+{
+    const uint32_t base_vertex = page.vertices.allocate(vertex_count);
+
+    if (base_vertex == UINT32_MAX)
+    {
+        return false;
+    }
+
+    const uint32_t first_index = page.indices.allocate(index_count);
+
+    if (first_index == UINT32_MAX)
+    {
+        page.vertices.free(base_vertex, vertex_count);
+
+        return false;
+    }
+
+    mesh.pooled_vertex_buffer = page.vertex_buffer;
+    mesh.pooled_index_buffer  = page.index_buffer;
+    mesh.base_vertex          = base_vertex;
+    mesh.first_index          = first_index;
+    mesh.pooled               = true;
+
+    return true;
+}
+
+bool GeometryPool::allocate(const bgfx::VertexLayout& layout, const bgfx::Memory* vertices, const bgfx::Memory* indices, Mesh& mesh)
+{
+    const uint32_t vertex_count = vertices->size / layout.getStride();
+    const uint32_t index_count  = indices ->size / sizeof(uint16_t);
+
+    if (vertex_count > GEOMETRY_PAGE_VERTICES || index_count > GEOMETRY_PAGE_INDICES)
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    uint32_t page_index = 0;
+
+    for (; page_index < pages.size(); page_index++)
+    {
+        if (pages[page_index].layout == &layout && allocate_from_page(pages[page_index], vertex_count, index_count, mesh))
+        {
+            break;
+        }
+    }
+
+    if (page_index == pages.size())
+    {
+        if (pages.size() == UINT16_MAX)
+        {
+            return false;
+        }
+
+        const bgfx::DynamicVertexBufferHandle vertex_buffer = bgfx::createDynamicVertexBuffer(GEOMETRY_PAGE_VERTICES, layout);
+        const bgfx::DynamicIndexBufferHandle  index_buffer  = bgfx::createDynamicIndexBuffer (GEOMETRY_PAGE_INDICES);
+
+        WARN(
+            bgfx::isValid(vertex_buffer) && bgfx::isValid(index_buffer),
+            "Failed to create shared geometry buffers."
+        );
+
+        if (!bgfx::isValid(vertex_buffer) || !bgfx::isValid(index_buffer))
+        {
+            if (bgfx::isValid(vertex_buffer)) { bgfx::destroy(vertex_buffer); }
+            if (bgfx::isValid(index_buffer )) { bgfx::destroy(index_buffer ); }
+
+            return false;
+        }
+
+        GeometryPage& page = pages.emplace_back();
+        page.layout        = &layout;
+        page.vertex_buffer = vertex_buffer;
+        page.index_buffer  = index_buffer;
+        page.vertices.init(GEOMETRY_PAGE_VERTICES);
+        page.indices .init(GEOMETRY_PAGE_INDICES );
+
+        allocate_from_page(page, vertex_count, index_count, mesh);
+    }
+
+    mesh.pool_page = uint16_t(page_index);
+
+    bgfx::update(mesh.pooled_vertex_buffer, mesh.base_vertex, vertices);
+    bgfx::update(mesh.pooled_index_buffer , mesh.first_index, indices );
+
+    return true;
+}
+
+void GeometryPool::free(const Mesh& mesh)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    freed_meshes[0].push_back(mesh);
+}
+
 void MeshCache::init()
 {
-    *this = {};
+    meshes.fill({});
+    pool  .init();
+
+    for (std::vector<uint32_t>& parts : batch_parts)
+    {
+        parts.clear();
+    }
+
+    for (std::vector<hmm_vec3>& triangles : occluders)
+    {
+        triangles.clear();
+    }
 }
 
 void MeshCache::cleanup()
 {
     for (Mesh& mesh : meshes)
     {
-        mesh.destroy();
+        mesh.destroy(pool);
+    }
+
+    for (std::vector<uint32_t>& parts : batch_parts)
+    {
+        std::vector<uint32_t>().swap(parts);
+    }
+
+    for (std::vector<hmm_vec3>& triangles : occluders)
+    {
+        std::vector<hmm_vec3>().swap(triangles);
     }
+
+    pool.cleanup();
 }
 
-void MeshCache::add_mesh(uint32_t id, const Mesh& mesh)
+void MeshCache::add_mesh(uint32_t id, const Mesh& mesh, std::span<const uint32_t> parts)
 {
     // NOTE : Not thread safe because users shouldn't create mesh with the same
     //        ID from multiple threads in the first place.
 
-    meshes[id].destroy();
+    meshes[id].destroy(pool);
     meshes[id] = mesh;
+
+    batch_parts[id].assign(parts.begin(), parts.end());
+    occluders  [id].clear();
+}
+
+void MeshCache::add_occluder(uint32_t id, const MeshDesc& desc)
+{
+    ASSERT(
+        (desc.flags & PRIMITIVE_TYPE_MASK) != PRIMITIVE_LINES,
+        "Line meshes can't be used as occluders."
+    );
+
+    const uint32_t vertex_size  = desc.layout->getStride();
+    const uint32_t vertex_count = desc.buffer.size() / vertex_size;
+
+    std::vector<hmm_vec3>& triangles = occluders[id];
+    triangles.resize(vertex_count - vertex_count % 3);
+
+    for (uint32_t i = 0; i < triangles.size(); i++)
+    {
+        triangles[i] = read_vertex_position(desc.buffer.data() + i * vertex_size);
+    }
+}
+
+bool MeshCache::get_batch_part(uint32_t id, uint32_t part, uint32_t& element_start, uint32_t& element_count) const
+{
+    const std::vector<uint32_t>& parts = batch_parts[id];
+
+    if (part >= parts.size())
+    {
+        return false;
+    }
+
+    // One index is generated for every recorded vertex, so vertex offsets of
+    // the parts are also their element offsets.
+    element_start = parts[part];
+    element_count = (part + 1 < parts.size() ? parts[part + 1] : meshes[id].element_count) - element_start;
+
+    return true;
+}
+
+void BatchRecorder::reset()
+{
+    parts.clear();
+    parts.push_back(0);
+}
+
+void BatchRecorder::begin_part(const VertexRecorder& recorder)
+{
+    ASSERT(
+        !recorder.emulate_quads || (recorder.invocation_count & 3) == 0,
+        "Static batch part started in the middle of a quad."
+    );
+
+    parts.push_back(recorder.vertex_count);
 }
 
 void MeshCache::invalidate_transient_meshes()
 {
+    // NOTE : Called once per frame, so it also recycles freed pool ranges.
+    pool.update();
+
     for (Mesh& mesh : meshes)
     {
         if (mesh.transient_vertex_buffer)
@@ -515,6 +912,37 @@ static const DefaultProgramDesc s_default_program_descs[] =
         VERTEX_TEXCOORD,
         "position_texcoord"
     },
+
+    {
+        INSTANCING_SUPPORTED,
+        "instancing_position",
+        "position"
+    },
+    {
+        INSTANCING_SUPPORTED | VERTEX_COLOR,
+        "instancing_position_color",
+        "position_color"
+    },
+    {
+        INSTANCING_SUPPORTED | VERTEX_COLOR | VERTEX_NORMAL,
+        "instancing_position_color_normal",
+        "position_color_normal"
+    },
+    {
+        INSTANCING_SUPPORTED | VERTEX_COLOR | VERTEX_TEXCOORD,
+        "instancing_position_color_texcoord",
+        "position_color_texcoord"
+    },
+    {
+        INSTANCING_SUPPORTED | VERTEX_NORMAL,
+        "instancing_position_normal",
+        "position_normal"
+    },
+    {
+        INSTANCING_SUPPORTED | VERTEX_TEXCOORD,
+        "instancing_position_texcoord",
+        "position_texcoord"
+    },
 };
 
 static const bgfx::EmbeddedShader s_default_shaders[] =
@@ -536,8 +964,17 @@ static const bgfx::EmbeddedShader s_default_shaders[] =
 
     BGFX_EMBEDDED_SHADER(position_texcoord_fs),
     BGFX_EMBEDDED_SHADER(position_texcoord_vs),
+
+    BGFX_EMBEDDED_SHADER(instancing_position_vs),
+    BGFX_EMBEDDED_SHADER(instancing_position_color_vs),
+    BGFX_EMBEDDED_SHADER(instancing_position_color_normal_vs),
+    BGFX_EMBEDDED_SHADER(instancing_position_color_texcoord_vs),
+    BGFX_EMBEDDED_SHADER(instancing_position_normal_vs),
+    BGFX_EMBEDDED_SHADER(instancing_position_texcoord_vs),
 };
 
+static constexpr uint32_t INSTANCING_SHIFT = 6;
+
 bgfx::ProgramHandle DefaultProgramCache::operator[](uint32_t flags) const
 {
     static_assert(
@@ -545,7 +982,14 @@ bgfx::ProgramHandle DefaultProgramCache::operator[](uint32_t flags) const
         "Invalid assumption about vertex attribute mask bits."
     );
 
-    const uint32_t index = (flags & VERTEX_ATTRIB_MASK) >> VERTEX_ATTRIB_SHIFT;
+    static_assert(
+        (INSTANCING_SUPPORTED >> INSTANCING_SHIFT) == 0b00001000,
+        "Invalid assumption about instancing flag bit."
+    );
+
+    const uint32_t index =
+        ((flags & VERTEX_ATTRIB_MASK  ) >> VERTEX_ATTRIB_SHIFT) |
+        ((flags & INSTANCING_SUPPORTED) >> INSTANCING_SHIFT   ) ;
 
     return programs[index];
 }
@@ -561,8 +1005,8 @@ void DefaultProgramCache::init(bgfx::RendererType::Enum renderer)
 
     programs.fill(BGFX_INVALID_HANDLE);
 
-    char vs_name[32];
-    char fs_name[32];
+    char vs_name[64];
+    char fs_name[64];
 
     for (const DefaultProgramDesc& desc : s_default_program_descs)
     {
@@ -657,181 +1101,303 @@ void DefaultUniformCache::cleanup()
 
 
 // -----------------------------------------------------------------------------
-// TEXTURES
+// UNIFORMS
 // -----------------------------------------------------------------------------
 
-static constexpr uint32_t TEXTURE_BORDER_SHIFT     = 1;
-static constexpr uint32_t TEXTURE_BORDER_MASK      = TEXTURE_MIRROR |
-                                                     TEXTURE_CLAMP  ;
-
-static constexpr uint32_t TEXTURE_FORMAT_SHIFT     = 3;
-static constexpr uint32_t TEXTURE_FORMAT_MASK      = TEXTURE_R8    |
-                                                     TEXTURE_D24S8 |
-                                                     TEXTURE_D32F  ;
-
-static constexpr uint32_t TEXTURE_SAMPLING_SHIFT   = 0;
-static constexpr uint32_t TEXTURE_SAMPLING_MASK    = TEXTURE_NEAREST;
-
-static constexpr uint32_t TEXTURE_TARGET_SHIFT     = 6;
-static constexpr uint32_t TEXTURE_TARGET_MASK      = TEXTURE_TARGET;
-
-static constexpr Texture  INVALID_TEXTURE          =
+static uint16_t get_uniform_size(bgfx::UniformType::Enum type)
 {
-    BGFX_INVALID_HANDLE,
-    0,
-    0,
-    bgfx::TextureFormat::Count,
-    bgfx::BackbufferRatio::Count,
-    BGFX_INVALID_HANDLE,
-    UINT32_MAX,
-};
+    switch (type)
+    {
+    case bgfx::UniformType::Sampler: return sizeof(int32_t);
+    case bgfx::UniformType::Vec4   : return 4 * sizeof(float);
+    case bgfx::UniformType::Mat3   : return 9 * sizeof(float);
+    case bgfx::UniformType::Mat4   : return 16 * sizeof(float);
+    default                        : return 0;
+    }
+}
 
-static uint64_t translate_texture_flags(uint32_t flags)
+void UniformCache::init()
 {
-    constexpr uint64_t sampling[] =
+    for (Uniform& uniform : uniforms)
     {
-        BGFX_SAMPLER_NONE,
-        BGFX_SAMPLER_POINT,
-    };
+        uniform = { BGFX_INVALID_HANDLE, 0, 0 };
+    }
+}
 
-    constexpr uint64_t border[] =
+void UniformCache::cleanup()
+{
+    for (Uniform& uniform : uniforms)
     {
-        BGFX_SAMPLER_NONE,
-        BGFX_SAMPLER_UVW_MIRROR,
-        BGFX_SAMPLER_UVW_CLAMP,
-    };
+        if (bgfx::isValid(uniform.handle))
+        {
+            bgfx::destroy(uniform.handle);
+        }
+    }
 
-    constexpr uint64_t target[] =
+    init();
+}
+
+void UniformCache::add_uniform(uint32_t id, bgfx::UniformType::Enum type, uint16_t count, const char* name)
+{
+    // NOTE : Not thread safe because users shouldn't create uniforms with the
+    //        same ID from multiple threads in the first place.
+
+    Uniform& uniform = uniforms[id];
+
+    if (bgfx::isValid(uniform.handle))
     {
-        BGFX_TEXTURE_NONE,
-        BGFX_TEXTURE_RT,
-    };
+        bgfx::destroy(uniform.handle);
+    }
 
-    return
-        sampling[(flags & TEXTURE_SAMPLING_MASK) >> TEXTURE_SAMPLING_SHIFT] |
-        border  [(flags & TEXTURE_BORDER_MASK  ) >> TEXTURE_BORDER_SHIFT  ] |
-        target  [(flags & TEXTURE_TARGET_MASK  ) >> TEXTURE_TARGET_SHIFT  ] ;
+    uniform.handle = bgfx::createUniform(name, type, count);
+    uniform.count  = count;
+    uniform.size   = get_uniform_size(type);
+
+    ASSERT(
+        bgfx::isValid(uniform.handle),
+        "Failed to create uniform '%s'.",
+        name
+    );
 }
 
-static bgfx::TextureFormat::Enum translate_texture_format(uint32_t flags, uint32_t& out_format_size)
+void UniformStaging::init()
 {
-    struct TextureFormat
-    {
-        uint32_t                  size;
-        bgfx::TextureFormat::Enum type;
-    };
+    pending    .clear();
+    last_values.clear();
+    last_owners.clear();
+    touched    .clear();
 
-    constexpr TextureFormat formats[] =
-    {
-        { 4, bgfx::TextureFormat::RGBA8 },
-        { 1, bgfx::TextureFormat::R8    },
-        { 0, bgfx::TextureFormat::D24S8 },
-        { 0, bgfx::TextureFormat::D32F  },
-    };
+    skip_redundant = false;
 
-    const TextureFormat format = formats[(flags & TEXTURE_FORMAT_MASK) >> TEXTURE_FORMAT_SHIFT];
+    reset();
+}
 
-    out_format_size = format.size;
+void UniformStaging::cleanup()
+{
+    std::vector<UniformValue        >().swap(pending    );
+    std::vector<UniformValue        >().swap(last_values);
+    std::vector<const bgfx::Encoder*>().swap(last_owners);
+    std::vector<uint16_t            >().swap(touched    );
+}
 
-    return format.type;
+void UniformStaging::reset()
+{
+    // NOTE : Must be called at least once per frame, as the tracked values
+    //        point into the frame arena (done when the thread-local frame
+    //        memory is swapped).
+    for (uint16_t idx : touched)
+    {
+        last_values[idx].data = nullptr;
+    }
+
+    touched.clear();
+
+    encoder = nullptr;
+    state   = 0;
+    pass    = UINT16_MAX;
+    program = BGFX_INVALID_HANDLE;
 }
 
-void Texture::create(const TextureDesc& desc, ArenaAllocator& allocator)
+void UniformStaging::stage(ArenaAllocator& allocator, const Uniform& uniform, const void* value)
 {
-    *this = INVALID_TEXTURE;
+    ASSERT(
+        bgfx::isValid(uniform.handle),
+        "Invalid uniform."
+    );
 
-    ratio  = bgfx::BackbufferRatio::Count;
-    width  = uint16_t(desc.width);
-    height = uint16_t(desc.height);
+    const uint32_t     size = uint32_t(uniform.count) * uniform.size;
+    std::span<uint8_t> data = allocator.allocate(size, 16);
 
-    uint32_t format_size = 0;
-    format = translate_texture_format(desc.flags, format_size);
+    REQUIRE(
+        data.size() == size,
+        "Failed to allocate %" PRIu32 " bytes of uniform data.",
+        size
+    );
 
-    blit_handle = BGFX_INVALID_HANDLE;
-    read_frame  = UINT32_MAX;
+    memcpy(data.data(), value, size);
 
-    if (width >= SIZE_EQUAL && width <= SIZE_DOUBLE && width == height)
+    for (UniformValue& staged : pending)
     {
-        ratio = bgfx::BackbufferRatio::Enum(desc.width - SIZE_EQUAL);
+        if (staged.handle.idx == uniform.handle.idx)
+        {
+            staged.data = data.data();
+            return;
+        }
     }
 
-    const bgfx::Memory* memory = nullptr;
+    pending.push_back({ uniform.handle, uniform.count, size, data.data() });
+}
 
-    if (desc.data && format_size > 0 && ratio == bgfx::BackbufferRatio::Count)
+std::span<const UniformValue> UniformStaging::take(ArenaAllocator& allocator)
+{
+    if (pending.empty())
     {
-        const uint32_t size = width * height * format_size;
+        return {};
+    }
 
-        memory = allocacte_bgfx_memory(allocator, size);
-        REQUIRE(
-            memory && memory->data,
-            "Failed to allocate memory for texture copy."
-        );
+    UniformValue* values = nullptr;
+    allocate(values, allocator, uint32_t(pending.size()));
+    REQUIRE(
+        values != nullptr,
+        "Failed to allocate draw uniform list."
+    );
+
+    memcpy(values, pending.data(), pending.size() * sizeof(UniformValue));
+
+    const std::span<const UniformValue> result(values, pending.size());
+
+    pending.clear();
+
+    return result;
+}
+
+void UniformStaging::begin_draw(const bgfx::Encoder& encoder_, bgfx::ViewId pass_, bgfx::ProgramHandle program_, uint64_t state_)
+{
+    // Skipping a redundant update relies on the renderer keeping the previous
+    // value, which only holds if BGFX doesn't reorder the two draws. Within one
+    // encoder, view, program and state, the submission order is preserved, but
+    // draws from other threads into the same view can land in between, which
+    // is why the skipping is opt-in.
+    if (!skip_redundant || &encoder_ != encoder || pass_ != pass || program_.idx != program.idx || state_ != state)
+    {
+        reset();
+
+        encoder = &encoder_;
+        pass    = pass_;
+        program = program_;
+        state   = state_;
+    }
+}
 
-        if (desc.stride == 0 || desc.stride == width * format_size)
+void UniformStaging::bind(bgfx::Encoder& encoder_, std::span<const UniformValue> values)
+{
+    // Values are unique per draw already (see `stage`).
+    if (!skip_redundant)
+    {
+        for (const UniformValue& value : values)
         {
-            memcpy(memory->data, desc.data, memory->size);
+            encoder_.setUniform(value.handle, value.data, value.count);
         }
-        else
+
+        return;
+    }
+
+    for (const UniformValue& value : values)
+    {
+        if (value.handle.idx >= last_values.size())
         {
-            const uint8_t* src  = static_cast<const uint8_t*>(desc.data);
-            uint8_t*       dst  = memory->data;
-            const uint32_t size = width * format_size;
+            last_values.resize(value.handle.idx + 1, { BGFX_INVALID_HANDLE, 0, 0, nullptr });
+            last_owners.resize(value.handle.idx + 1, nullptr);
+        }
 
-            for (uint16_t y = 0; y < height; y++)
-            {
-                memcpy(dst, src, size);
+        UniformValue&         last  = last_values[value.handle.idx];
+        const bgfx::Encoder*& owner = last_owners[value.handle.idx];
 
-                src += desc.stride;
-                dst += size;
-            }
+        // Values set through another encoder don't count, as its draws can be
+        // ordered arbitrarily relative to this one's.
+        if (last.data && owner == &encoder_ && last.size == value.size && !memcmp(last.data, value.data, value.size))
+        {
+            continue;
         }
-    }
 
-    const uint64_t texture_flags = translate_texture_flags(desc.flags);
+        if (!last.data)
+        {
+            touched.push_back(value.handle.idx);
+        }
 
-    if (ratio == bgfx::BackbufferRatio::Count)
-    {
-        handle = bgfx::createTexture2D(width, height, false, 1, format, texture_flags, memory);
+        encoder_.setUniform(value.handle, value.data, value.count);
+
+        last  = value;
+        owner = &encoder_;
     }
-    else
-    {
-        WARN(
-            !memory,
-            "Texture content ignored."
-        );
+}
 
-        handle = bgfx::createTexture2D(ratio, false, 1, format, texture_flags);
+void UniformStaging::forget(bgfx::UniformHandle handle)
+{
+    if (handle.idx < last_values.size())
+    {
+        last_values[handle.idx].data = nullptr;
     }
-    REQUIRE(
-        bgfx::isValid(handle),
-        "Failed to create BGFX texture."
-    );
 }
 
-void Texture::destroy()
+
+// -----------------------------------------------------------------------------
+// READBACK
+// -----------------------------------------------------------------------------
+
+static void readback_callback_task(void* data)
+{
+    ReadbackSlot* slot = static_cast<ReadbackSlot*>(data);
+
+    const void* output_data = slot->output_data ? slot->output_data : slot->staging.data();
+
+    (*slot->callback)(output_data, slot->width, slot->height, slot->user_data);
+
+    slot->busy.store(false, std::memory_order_release);
+}
+
+void ReadbackRing::init()
 {
-    if (bgfx::isValid(handle))
+    for (ReadbackSlot& slot : slots)
     {
-        bgfx::destroy(handle);
+        slot.blit_handle = BGFX_INVALID_HANDLE;
+        slot.format      = bgfx::TextureFormat::Count;
+        slot.width       = 0;
+        slot.height      = 0;
+        slot.output_data = nullptr;
+        slot.callback    = nullptr;
+        slot.user_data   = nullptr;
+        slot.frame       = UINT32_MAX;
+
+        slot.busy.store(false, std::memory_order_relaxed);
     }
 
-    if (bgfx::isValid(blit_handle))
+    next = 0;
+}
+
+void ReadbackRing::cleanup()
+{
+    for (ReadbackSlot& slot : slots)
     {
-        bgfx::destroy(blit_handle);
+        while (slot.busy.load(std::memory_order_acquire))
+        {
+            std::this_thread::yield();
+        }
+
+        if (bgfx::isValid(slot.blit_handle))
+        {
+            bgfx::destroy(slot.blit_handle);
+        }
+
+        std::vector<uint8_t>().swap(slot.staging);
     }
 
-    *this = INVALID_TEXTURE;
+    init();
 }
 
-void Texture::schedule_read(bgfx::ViewId pass, bgfx::Encoder& encoder, void* output_data)
+uint32_t ReadbackRing::schedule(bgfx::ViewId pass, bgfx::Encoder& encoder, bgfx::TextureHandle source, uint16_t width, uint16_t height, bgfx::TextureFormat::Enum format, void* output_data, ReadbackCallback callback, void* user_data)
 {
-    REQUIRE(
-        bgfx::isValid(handle),
-        "Invalid texture."
+    ASSERT(
+        output_data || callback,
+        "Readback needs either output data or callback."
     );
 
-    if (!bgfx::isValid(blit_handle))
+    ReadbackSlot& slot = slots[next];
+
+    if (slot.frame != UINT32_MAX || slot.busy.load(std::memory_order_acquire))
+    {
+        return UINT32_MAX;
+    }
+
+    next = (next + 1) % READBACK_RING_SIZE;
+
+    if (slot.width != width || slot.height != height || slot.format != format)
     {
+        if (bgfx::isValid(slot.blit_handle))
+        {
+            bgfx::destroy(slot.blit_handle);
+        }
+
         constexpr uint64_t flags =
             BGFX_TEXTURE_BLIT_DST  |
             BGFX_TEXTURE_READ_BACK |
@@ -841,369 +1407,4146 @@ void Texture::schedule_read(bgfx::ViewId pass, bgfx::Encoder& encoder, void* out
             BGFX_SAMPLER_U_CLAMP   |
             BGFX_SAMPLER_V_CLAMP   ;
 
-        if (ratio == bgfx::BackbufferRatio::Count)
-        {
-            blit_handle = bgfx::createTexture2D(width, height, false, 1, format, flags);
-        }
-        else
-        {
-            blit_handle = bgfx::createTexture2D(ratio, false, 1, format, flags);
-        }
+        slot.blit_handle = bgfx::createTexture2D(width, height, false, 1, format, flags);
         REQUIRE(
-            bgfx::isValid(blit_handle),
+            bgfx::isValid(slot.blit_handle),
             "Failed to create BGFX blit texture."
         );
+
+        slot.width  = width;
+        slot.height = height;
+        slot.format = format;
     }
 
-    encoder.blit(pass, blit_handle, 0, 0, handle);
+    slot.output_data = output_data;
+    slot.callback    = callback;
+    slot.user_data   = user_data;
 
-    read_frame = bgfx::readTexture(blit_handle, output_data);
-}
+    if (!output_data)
+    {
+        // NOTE : BIMG and BGFX texture format enums match.
+        slot.staging.resize(uint32_t(width) * height * bimg::getBitsPerPixel(bimg::TextureFormat::Enum(format)) / 8);
 
-Texture& TextureCache::operator[](uint32_t id)
-{
-    return textures[id];
-}
+        output_data = slot.staging.data();
+    }
 
-void TextureCache::init()
-{
-    *this = {};
+    encoder.blit(pass, slot.blit_handle, 0, 0, source);
 
-    textures.fill(INVALID_TEXTURE);
+    slot.frame = bgfx::readTexture(slot.blit_handle, output_data);
+
+    return slot.frame;
 }
 
-void TextureCache::cleanup()
+void ReadbackRing::update(uint32_t frame, TaskQueueFunc queue_task)
 {
-    for (Texture& texture : textures)
+    for (ReadbackSlot& slot : slots)
     {
-        texture.destroy();
-    }
+        if (slot.frame == UINT32_MAX || slot.frame > frame)
+        {
+            continue;
+        }
 
-    *this = {};
-}
+        slot.frame = UINT32_MAX;
 
-void TextureCache::add_texture(uint32_t id, const Texture& texture)
-{
-    // NOTE : Not thread safe because users shouldn't create textures with the
-    //        same ID from multiple threads in the first place.
+        if (!slot.callback)
+        {
+            continue;
+        }
 
-    textures[id].destroy();
-    textures[id] = texture;
+        slot.busy.store(true, std::memory_order_relaxed);
+
+        if (!queue_task || !(*queue_task)(readback_callback_task, &slot))
+        {
+            readback_callback_task(&slot);
+        }
+    }
 }
 
 
 // -----------------------------------------------------------------------------
-// MATRIX STACK
+// TEXTURES
 // -----------------------------------------------------------------------------
 
-void MatrixStack::init()
-{
-    top  = HMM_Mat4d(1.0f);
-    size = 0;
-}
+static constexpr uint32_t TEXTURE_BORDER_SHIFT      = 1;
+static constexpr uint32_t TEXTURE_BORDER_MASK       = TEXTURE_MIRROR |
+                                                      TEXTURE_CLAMP  ;
 
-void MatrixStack::push()
-{
-    matrices[size++] = top;
-}
+static constexpr uint32_t TEXTURE_COMPRESSION_SHIFT = 11;
+static constexpr uint32_t TEXTURE_COMPRESSION_MASK  = TEXTURE_BC1 |
+                                                      TEXTURE_BC3 |
+                                                      TEXTURE_BC4 |
+                                                      TEXTURE_BC5 |
+                                                      TEXTURE_BC7 ;
 
-void MatrixStack::pop()
-{
-    top = matrices[--size];
-}
+static constexpr uint32_t TEXTURE_FORMAT_SHIFT      = 3;
+static constexpr uint32_t TEXTURE_FORMAT_MASK       = TEXTURE_R8    |
+                                                      TEXTURE_D24S8 |
+                                                      TEXTURE_D32F  ;
 
-void MatrixStack::multiply_top(const hmm_mat4& matrix)
-{
-    top = matrix * top;
-}
+static constexpr uint32_t TEXTURE_SAMPLING_SHIFT    = 0;
+static constexpr uint32_t TEXTURE_SAMPLING_MASK     = TEXTURE_NEAREST;
 
+static constexpr uint32_t TEXTURE_TARGET_SHIFT      = 6;
+static constexpr uint32_t TEXTURE_TARGET_MASK       = TEXTURE_TARGET;
 
-// -----------------------------------------------------------------------------
-// PASSES
-// -----------------------------------------------------------------------------
+static constexpr Texture  INVALID_TEXTURE           =
+{
+    BGFX_INVALID_HANDLE,
+    0,
+    0,
+    bgfx::TextureFormat::Count,
+    bgfx::BackbufferRatio::Count,
+    nullptr,
+    UINT32_MAX,
+    0,
+    false,
+    false,
+    false,
+};
 
-void Pass::init()
+static uint64_t translate_texture_flags(uint32_t flags)
 {
-    view_matrix     = HMM_Mat4d(1.0f);
-    proj_matrix     = HMM_Mat4d(1.0f);
+    constexpr uint64_t sampling[] =
+    {
+        BGFX_SAMPLER_NONE,
+        BGFX_SAMPLER_POINT,
+    };
 
-    viewport_x      = 0;
-    viewport_y      = 0;
-    viewport_width  = SIZE_EQUAL;
-    viewport_height = SIZE_EQUAL;
+    constexpr uint64_t border[] =
+    {
+        BGFX_SAMPLER_NONE,
+        BGFX_SAMPLER_UVW_MIRROR,
+        BGFX_SAMPLER_UVW_CLAMP,
+    };
 
-    framebuffer     = BGFX_INVALID_HANDLE;
+    constexpr uint64_t target[] =
+    {
+        BGFX_TEXTURE_NONE,
+        BGFX_TEXTURE_RT,
+    };
 
-    clear_flags     = BGFX_CLEAR_NONE;
-    clear_depth     = 1.0f;
-    clear_rgba      = 0x000000ff;
-    clear_stencil   = 0;
+    return
+        sampling[(flags & TEXTURE_SAMPLING_MASK) >> TEXTURE_SAMPLING_SHIFT] |
+        border  [(flags & TEXTURE_BORDER_MASK  ) >> TEXTURE_BORDER_SHIFT  ] |
+        target  [(flags & TEXTURE_TARGET_MASK  ) >> TEXTURE_TARGET_SHIFT  ] ;
+}
+
+static bgfx::TextureFormat::Enum translate_texture_format(uint32_t flags, uint32_t& out_format_size)
+{
+    struct TextureFormat
+    {
+        uint32_t                  size;
+        bgfx::TextureFormat::Enum type;
+    };
+
+    constexpr TextureFormat formats[] =
+    {
+        { 4, bgfx::TextureFormat::RGBA8 },
+        { 1, bgfx::TextureFormat::R8    },
+        { 0, bgfx::TextureFormat::D24S8 },
+        { 0, bgfx::TextureFormat::D32F  },
+    };
+
+    const TextureFormat format = formats[(flags & TEXTURE_FORMAT_MASK) >> TEXTURE_FORMAT_SHIFT];
+
+    out_format_size = format.size;
+
+    return format.type;
+}
+
+static uint32_t get_mip_count(uint32_t width, uint32_t height)
+{
+    uint32_t count = 1;
+
+    while (width > 1 || height > 1)
+    {
+        width  = bx::max(width  >> 1, 1u);
+        height = bx::max(height >> 1, 1u);
+
+        count++;
+    }
+
+    return count;
+}
+
+static uint32_t get_mip_chain_size(uint32_t width, uint32_t height, uint32_t format_size)
+{
+    uint32_t size = 0;
+
+    for (uint32_t i = 0, count = get_mip_count(width, height); i < count; i++)
+    {
+        size += bx::max(width >> i, 1u) * bx::max(height >> i, 1u) * format_size;
+    }
+
+    return size;
+}
+
+// Four RGBA8 texels, one per lane. Source rows aren't aligned.
+static bx::simd128_t load_rgba8x4(const uint8_t* texels)
+{
+    alignas(16) uint8_t aligned[16];
+    memcpy(aligned, texels, sizeof(aligned));
+
+    return bx::simd_ld<bx::simd128_t>(aligned);
+}
+
+static void store_rgba8x4(uint8_t* texels, bx::simd128_t value)
+{
+    alignas(16) uint8_t aligned[16];
+    bx::simd_st(aligned, value);
+
+    memcpy(texels, aligned, sizeof(aligned));
+}
+
+// Single channel of four RGBA8 texels, in `[0, 1]` range.
+template <int Shift>
+static bx::simd128_t unpack_rgba8_channel(bx::simd128_t texels)
+{
+    using namespace bx;
+
+    const simd128_t value = simd_and(simd_srl(texels, Shift), simd_isplat<simd128_t>(0xff));
+
+    return simd_mul(simd_itof(value), simd_splat<simd128_t>(1.0f / 255.0f));
+}
+
+template <int Shift>
+static bx::simd128_t pack_rgba8_channel(bx::simd128_t value)
+{
+    using namespace bx;
+
+    const simd128_t to_byte = simd_splat<simd128_t>(255.0f);
+    const simd128_t scaled  = simd_min(simd_madd(value, to_byte, simd_splat<simd128_t>(0.5f)), to_byte);
+
+    return simd_sll(simd_ftoi(scaled), Shift);
+}
+
+// Sums adjacent pairs of two groups of four values. The result is in
+// `[0 + 1, 4 + 5, 2 + 3, 6 + 7]` order.
+static bx::simd128_t sum_pairs(bx::simd128_t lo, bx::simd128_t hi)
+{
+    return bx::simd_add(bx::simd_shuf_xAzC(lo, hi), bx::simd_shuf_yBwD(lo, hi));
+}
+
+// Gamma 2.0 is used as an approximation of sRGB, so that decoding and encoding
+// are just a multiplication and a square root.
+static void downsample_rgba8_texel(const uint8_t* const rows[2], const uint32_t columns[2], uint8_t* dst)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        float sum = 0.0f;
+
+        for (int j = 0; j < 4; j++)
+        {
+            const float value = rows[j >> 1][columns[j & 1] + i] * (1.0f / 255.0f);
+
+            sum += i < 3 ? value * value : value;
+        }
+
+        const float average = sum * 0.25f;
+        const float encoded = i < 3 ? bx::sqrt(average) : average;
+
+        dst[i] = uint8_t(bx::min(encoded * 255.0f + 0.5f, 255.0f));
+    }
+}
+
+// Four destination texels per iteration (eight source texels per row), with
+// channels unpacked into separate vectors. Edge texels go through the scalar
+// path, which clamps the source coordinates.
+static void downsample_rgba8(const uint8_t* src, uint32_t src_width, uint32_t src_height, uint8_t* dst)
+{
+    using namespace bx;
+
+    const uint32_t dst_width    = bx::max(src_width  >> 1, 1u);
+    const uint32_t dst_height   = bx::max(src_height >> 1, 1u);
+    const uint32_t vector_width = (src_width >> 1) & ~3u;
+
+    const simd128_t quarter = simd_splat<simd128_t>(0.25f);
+
+    for (uint32_t y = 0; y < dst_height; y++)
+    {
+        const uint8_t* const rows[] =
+        {
+            src + (bx::min(2 * y    , src_height - 1) * src_width) * 4,
+            src + (bx::min(2 * y + 1, src_height - 1) * src_width) * 4,
+        };
+
+        uint8_t* dst_row = dst + y * dst_width * 4;
+
+        for (uint32_t x = 0; x < vector_width; x += 4)
+        {
+            simd128_t r = simd_zero<simd128_t>();
+            simd128_t g = simd_zero<simd128_t>();
+            simd128_t b = simd_zero<simd128_t>();
+            simd128_t a = simd_zero<simd128_t>();
+
+            for (const uint8_t* row : rows)
+            {
+                const simd128_t lo   = load_rgba8x4(row + x * 8     );
+                const simd128_t hi   = load_rgba8x4(row + x * 8 + 16);
+
+                const simd128_t r_lo = unpack_rgba8_channel< 0>(lo);
+                const simd128_t r_hi = unpack_rgba8_channel< 0>(hi);
+                const simd128_t g_lo = unpack_rgba8_channel< 8>(lo);
+                const simd128_t g_hi = unpack_rgba8_channel< 8>(hi);
+                const simd128_t b_lo = unpack_rgba8_channel<16>(lo);
+                const simd128_t b_hi = unpack_rgba8_channel<16>(hi);
+                const simd128_t a_lo = unpack_rgba8_channel<24>(lo);
+                const simd128_t a_hi = unpack_rgba8_channel<24>(hi);
+
+                r = simd_add(r, sum_pairs(simd_mul(r_lo, r_lo), simd_mul(r_hi, r_hi)));
+                g = simd_add(g, sum_pairs(simd_mul(g_lo, g_lo), simd_mul(g_hi, g_hi)));
+                b = simd_add(b, sum_pairs(simd_mul(b_lo, b_lo), simd_mul(b_hi, b_hi)));
+                a = simd_add(a, sum_pairs(a_lo, a_hi));
+            }
+
+            r = simd_sqrt(simd_mul(r, quarter));
+            g = simd_sqrt(simd_mul(g, quarter));
+            b = simd_sqrt(simd_mul(b, quarter));
+            a = simd_mul(a, quarter);
+
+            const simd128_t packed = simd_or(
+                simd_or(pack_rgba8_channel< 0>(r), pack_rgba8_channel< 8>(g)),
+                simd_or(pack_rgba8_channel<16>(b), pack_rgba8_channel<24>(a))
+            );
+
+            // Back from the `sum_pairs` order.
+            store_rgba8x4(dst_row + x * 4, simd_swiz_xzyw(packed));
+        }
+
+        for (uint32_t x = vector_width; x < dst_width; x++)
+        {
+            const uint32_t columns[] =
+            {
+                bx::min(2 * x    , src_width - 1) * 4,
+                bx::min(2 * x + 1, src_width - 1) * 4,
+            };
+
+            downsample_rgba8_texel(rows, columns, dst_row + x * 4);
+        }
+    }
+}
+
+static void downsample_r8(const uint8_t* src, uint32_t src_width, uint32_t src_height, uint8_t* dst)
+{
+    const uint32_t dst_width  = bx::max(src_width  >> 1, 1u);
+    const uint32_t dst_height = bx::max(src_height >> 1, 1u);
+
+    for (uint32_t y = 0; y < dst_height; y++)
+    {
+        const uint8_t* row0 = src + bx::min(2 * y    , src_height - 1) * src_width;
+        const uint8_t* row1 = src + bx::min(2 * y + 1, src_height - 1) * src_width;
+
+        for (uint32_t x = 0; x < dst_width; x++)
+        {
+            const uint32_t x0 = bx::min(2 * x    , src_width - 1);
+            const uint32_t x1 = bx::min(2 * x + 1, src_width - 1);
+
+            dst[y * dst_width + x] = uint8_t((row0[x0] + row0[x1] + row1[x0] + row1[x1] + 2) >> 2);
+        }
+    }
+}
+
+// Fills the levels following the first one, which must already be present.
+// Levels are tightly packed one after another, as BGFX expects.
+static void generate_mips(uint8_t* data, uint32_t width, uint32_t height, uint32_t format_size)
+{
+    ASSERT(
+        format_size == 4 || format_size == 1,
+        "Mip generation only supports RGBA8 and R8 formats."
+    );
+
+    const uint32_t count = get_mip_count(width, height);
+
+    for (uint32_t i = 1; i < count; i++)
+    {
+        uint8_t* next = data + width * height * format_size;
+
+        if (format_size == 4)
+        {
+            downsample_rgba8(data, width, height, next);
+        }
+        else
+        {
+            downsample_r8(data, width, height, next);
+        }
+
+        data   = next;
+        width  = bx::max(width  >> 1, 1u);
+        height = bx::max(height >> 1, 1u);
+    }
+}
+
+void Texture::create(const TextureDesc& desc, ArenaAllocator& allocator)
+{
+    *this = INVALID_TEXTURE;
+
+    ratio  = bgfx::BackbufferRatio::Count;
+    width  = uint16_t(desc.width);
+    height = uint16_t(desc.height);
+
+    uint32_t format_size = 0;
+    format = translate_texture_format(desc.flags, format_size);
+
+    if (width >= SIZE_EQUAL && width <= SIZE_DOUBLE && width == height)
+    {
+        ratio = bgfx::BackbufferRatio::Enum(desc.width - SIZE_EQUAL);
+    }
+
+    const bgfx::Memory* memory   = nullptr;
+    bool                has_mips = false;
+
+    if (desc.data && format_size > 0 && ratio == bgfx::BackbufferRatio::Count)
+    {
+        const uint32_t size = width * height * format_size;
+
+        has_mips = desc.flags & TEXTURE_MIPMAPS;
+
+        if (!has_mips && (desc.stride == 0 || desc.stride == width * format_size))
+        {
+            // The data has to stay valid for two frames anyway, so it can be
+            // referenced without a copy.
+            memory = bgfx::makeRef(desc.data, size, desc.release, desc.user_data);
+        }
+        else
+        {
+            // The whole mip chain is uploaded in a single memory block.
+            memory = allocacte_bgfx_memory(allocator, has_mips ? get_mip_chain_size(width, height, format_size) : size);
+            REQUIRE(
+                memory && memory->data,
+                "Failed to allocate memory for texture copy."
+            );
+
+            const uint8_t* src      = static_cast<const uint8_t*>(desc.data);
+            uint8_t*       dst      = memory->data;
+            const uint32_t row_size = width * format_size;
+            const uint32_t stride   = desc.stride ? desc.stride : row_size;
+
+            for (uint16_t y = 0; y < height; y++)
+            {
+                memcpy(dst, src, row_size);
+
+                src += stride;
+                dst += row_size;
+            }
+
+            if (has_mips)
+            {
+                generate_mips(memory->data, width, height, format_size);
+            }
+
+            if (desc.release)
+            {
+                (*desc.release)(const_cast<void*>(desc.data), desc.user_data);
+            }
+        }
+    }
+    else if (desc.data && desc.release)
+    {
+        (*desc.release)(const_cast<void*>(desc.data), desc.user_data);
+    }
+
+    const uint64_t texture_flags = translate_texture_flags(desc.flags);
+
+    if (ratio == bgfx::BackbufferRatio::Count)
+    {
+        handle = bgfx::createTexture2D(width, height, has_mips, 1, format, texture_flags, memory);
+    }
+    else
+    {
+        WARN(
+            !memory,
+            "Texture content ignored."
+        );
+
+        handle = bgfx::createTexture2D(ratio, false, 1, format, texture_flags);
+    }
+    REQUIRE(
+        bgfx::isValid(handle),
+        "Failed to create BGFX texture."
+    );
+
+    // NOTE : Backbuffer-size-related textures aren't accounted for, but they
+    //        are render targets, which are never evicted anyway.
+    if (ratio == bgfx::BackbufferRatio::Count)
+    {
+        bgfx::TextureInfo info;
+        bgfx::calcTextureSize(info, width, height, 1, false, has_mips, 1, format);
+
+        size = info.storageSize;
+    }
+
+    evictable = memory && !(desc.flags & TEXTURE_TARGET);
+}
+
+static void release_bimg_image(void*, void* user_data)
+{
+    bimg::imageFree(static_cast<bimg::ImageContainer*>(user_data));
+}
+
+void Texture::create(bimg::ImageContainer* image, uint32_t flags)
+{
+    *this = INVALID_TEXTURE;
+
+    width  = uint16_t(image->m_width );
+    height = uint16_t(image->m_height);
+
+    // NOTE : BIMG and BGFX texture format enums match.
+    format = bgfx::TextureFormat::Enum(image->m_format);
+
+    // Block-compressed formats aren't supported everywhere, so those are
+    // decompressed as a fallback.
+    if (bimg::isCompressed(image->m_format) &&
+        !bgfx::isTextureValid(0, false, 1, format, translate_texture_flags(flags)))
+    {
+        bimg::ImageContainer* converted = bimg::imageConvert(image->m_allocator, bimg::TextureFormat::RGBA8, *image);
+
+        WARN(
+            converted,
+            "Unsupported compressed texture format %i.",
+            int(format)
+        );
+
+        if (converted)
+        {
+            bimg::imageFree(image);
+
+            image  = converted;
+            format = bgfx::TextureFormat::RGBA8;
+        }
+    }
+
+    const bool is_2d    = !image->m_cubeMap && image->m_depth <= 1 && image->m_numLayers <= 1;
+    const bool has_mips = image->m_numMips > 1;
+
+    WARN(
+        is_2d,
+        "Only the first 2D image of a texture file is used."
+    );
+
+    const bgfx::Memory* memory = nullptr;
+
+    if (is_2d)
+    {
+        // The image is released by BGFX once the upload is done, so there's
+        // no extra copy.
+        memory = bgfx::makeRef(image->m_data, image->m_size, release_bimg_image, image);
+    }
+    else
+    {
+        // Mip chain of the first face / layer / slice only. Faces and layers
+        // are stored one after another, depth slices within each mip.
+        bimg::ImageMip mip;
+        uint32_t       mips_size = 0;
+
+        for (uint8_t lod = 0; lod < image->m_numMips; lod++)
+        {
+            if (bimg::imageGetRawData(*image, 0, lod, image->m_data, image->m_size, mip))
+            {
+                mips_size += mip.m_size / bx::max(mip.m_depth, 1u);
+            }
+        }
+
+        memory = bgfx::alloc(mips_size);
+
+        uint8_t* dst = memory->data;
+
+        for (uint8_t lod = 0; lod < image->m_numMips; lod++)
+        {
+            if (bimg::imageGetRawData(*image, 0, lod, image->m_data, image->m_size, mip))
+            {
+                const uint32_t slice_size = mip.m_size / bx::max(mip.m_depth, 1u);
+
+                memcpy(dst, mip.m_data, slice_size);
+
+                dst += slice_size;
+            }
+        }
+
+        bimg::imageFree(image);
+    }
+
+    size      = memory->size;
+    evictable = true;
+
+    handle = bgfx::createTexture2D(width, height, has_mips, 1, format, translate_texture_flags(flags), memory);
+    REQUIRE(
+        bgfx::isValid(handle),
+        "Failed to create BGFX texture."
+    );
+}
+
+void Texture::destroy()
+{
+    if (bgfx::isValid(handle) && !transient)
+    {
+        bgfx::destroy(handle);
+    }
+
+    if (readback)
+    {
+        readback->cleanup();
+
+        delete readback;
+    }
+
+    *this = INVALID_TEXTURE;
+}
+
+bool Texture::schedule_read(bgfx::ViewId pass, bgfx::Encoder& encoder, uint16_t current_width, uint16_t current_height, void* output_data, ReadbackCallback callback, void* user_data)
+{
+    REQUIRE(
+        bgfx::isValid(handle),
+        "Invalid texture."
+    );
+
+    if (!readback)
+    {
+        readback = new ReadbackRing();
+        readback->init();
+    }
+
+    const uint32_t frame = readback->schedule(pass, encoder, handle, current_width, current_height, format, output_data, callback, user_data);
+
+    WARN(
+        frame != UINT32_MAX,
+        "Too many texture reads in flight."
+    );
+
+    if (frame != UINT32_MAX && output_data)
+    {
+        read_frame = frame;
+    }
+
+    return frame != UINT32_MAX;
+}
+
+Texture& TextureCache::operator[](uint32_t id)
+{
+    return textures[id];
+}
+
+void TextureCache::init()
+{
+    textures.fill(INVALID_TEXTURE);
+
+    for (std::atomic<bool>& value : evicted)
+    {
+        value.store(false, std::memory_order_relaxed);
+    }
+
+    handle_count   = bgfx::getCaps()->limits.maxTextures;
+    last_used      = std::make_unique<std::atomic<uint32_t>[]>(handle_count);
+    pins           = std::make_unique<std::atomic<uint32_t>[]>(handle_count);
+    total_size     = 0;
+    budget         = 0;
+    evicted_hook   = nullptr;
+    reload_hook    = nullptr;
+    hook_user_data = nullptr;
+
+    frame.store(0, std::memory_order_relaxed);
+}
+
+void TextureCache::cleanup()
+{
+    for (Texture& texture : textures)
+    {
+        texture.destroy();
+    }
+
+    last_used.reset();
+    pins     .reset();
+
+    handle_count = 0;
+    total_size   = 0;
+}
+
+void TextureCache::add_texture(uint32_t id, const Texture& texture)
+{
+    // NOTE : Not thread safe because users shouldn't create textures with the
+    //        same ID from multiple threads in the first place.
+
+    total_size -= textures[id].size;
+
+    textures[id].destroy();
+    textures[id] = texture;
+
+    total_size += texture.size;
+
+    evicted[id].store(false, std::memory_order_relaxed);
+
+    if (bgfx::isValid(texture.handle) && texture.handle.idx < handle_count)
+    {
+        last_used[texture.handle.idx].store(frame.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+}
+
+void TextureCache::touch(bgfx::TextureHandle handle)
+{
+    if (handle.idx < handle_count)
+    {
+        last_used[handle.idx].store(frame.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+}
+
+void TextureCache::pin(bgfx::TextureHandle handle)
+{
+    if (bgfx::isValid(handle) && handle.idx < handle_count)
+    {
+        pins[handle.idx].fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void TextureCache::unpin(bgfx::TextureHandle handle)
+{
+    if (bgfx::isValid(handle) && handle.idx < handle_count)
+    {
+        const uint32_t count = pins[handle.idx].fetch_sub(1, std::memory_order_relaxed);
+
+        ASSERT(
+            count > 0,
+            "Texture unpinned more times than pinned."
+        );
+    }
+}
+
+void TextureCache::update(uint32_t frame_)
+{
+    frame.store(frame_, std::memory_order_relaxed);
+
+    if (budget == 0 || total_size <= budget)
+    {
+        return;
+    }
+
+    std::array<uint16_t, MAX_TEXTURES> candidates;
+    uint32_t                           count = 0;
+
+    for (uint32_t id = 0; id < MAX_TEXTURES; id++)
+    {
+        const Texture& texture = textures[id];
+
+        // Textures used in this or the previous frame are kept, so that they
+        // don't get evicted and reloaded repeatedly.
+        if (texture.evictable && bgfx::isValid(texture.handle) &&
+            pins[texture.handle.idx].load(std::memory_order_relaxed) == 0 &&
+            last_used[texture.handle.idx].load(std::memory_order_relaxed) + 1 < frame_)
+        {
+            candidates[count++] = uint16_t(id);
+        }
+    }
+
+    std::sort(candidates.begin(), candidates.begin() + count, [&](uint16_t a, uint16_t b)
+    {
+        return
+            last_used[textures[a].handle.idx].load(std::memory_order_relaxed) <
+            last_used[textures[b].handle.idx].load(std::memory_order_relaxed);
+    });
+
+    for (uint32_t i = 0; i < count && total_size > budget; i++)
+    {
+        const uint32_t id = candidates[i];
+
+        total_size -= textures[id].size;
+
+        textures[id].destroy();
+
+        evicted[id].store(true, std::memory_order_release);
+
+        if (evicted_hook)
+        {
+            (*evicted_hook)(int(id), hook_user_data);
+        }
+    }
+}
+
+bool TextureCache::request(uint32_t id)
+{
+    if (!evicted[id].load(std::memory_order_acquire))
+    {
+        return true;
+    }
+
+    // Only the first request after the eviction triggers the reload.
+    if (evicted[id].exchange(false, std::memory_order_acq_rel) && reload_hook)
+    {
+        (*reload_hook)(int(id), hook_user_data);
+    }
+
+    return false;
+}
+
+void TextureCache::update_readbacks(uint32_t frame, TaskQueueFunc queue_task)
+{
+    for (Texture& texture : textures)
+    {
+        if (texture.readback)
+        {
+            texture.readback->update(frame, queue_task);
+        }
+    }
+}
+
+static bool contains(const TextureUpdate& outer, const TextureUpdate& inner)
+{
+    return
+        inner.x                >= outer.x                &&
+        inner.y                >= outer.y                &&
+        inner.x + inner.width  <= outer.x + outer.width  &&
+        inner.y + inner.height <= outer.y + outer.height ;
+}
+
+static bool overlaps(const TextureUpdate& a, const TextureUpdate& b)
+{
+    return
+        a.x < b.x + b.width  && b.x < a.x + a.width  &&
+        a.y < b.y + b.height && b.y < a.y + a.height ;
+}
+
+// Copies `src` into the `dst` region it's contained in.
+static void copy_texture_update(const TextureUpdate& src, TextureUpdate& dst)
+{
+    const uint32_t src_pitch = src.width * src.format_size;
+    const uint32_t dst_pitch = dst.width * dst.format_size;
+
+    const uint8_t* src_row = src.data;
+    uint8_t*       dst_row = dst.data + (src.y - dst.y) * dst_pitch + (src.x - dst.x) * dst.format_size;
+
+    for (uint16_t y = 0; y < src.height; y++)
+    {
+        memcpy(dst_row, src_row, src_pitch);
+
+        src_row += src_pitch;
+        dst_row += dst_pitch;
+    }
+}
+
+static void coalesce_texture_update(std::vector<TextureUpdate>& groups, const TextureUpdate& update, ArenaAllocator& allocator)
+{
+    // Going backwards, the update can only be merged into a group, if no later
+    // group overlaps it, otherwise the upload order would change.
+    for (size_t i = groups.size(); i-- > 0;)
+    {
+        TextureUpdate& group = groups[i];
+
+        if (group.id != update.id)
+        {
+            continue;
+        }
+
+        if (contains(update, group))
+        {
+            groups.erase(groups.begin() + i);
+            continue;
+        }
+
+        if (contains(group, update))
+        {
+            copy_texture_update(update, group);
+            return;
+        }
+
+        const bool vertical =
+            group.x     == update.x     &&
+            group.width == update.width &&
+            (group.y + group.height == update.y || update.y + update.height == group.y);
+
+        const bool horizontal =
+            group.y      == update.y      &&
+            group.height == update.height &&
+            (group.x + group.width == update.x || update.x + update.width == group.x);
+
+        if (vertical || horizontal)
+        {
+            TextureUpdate merged = group;
+
+            merged.x      = bx::min(group.x, update.x);
+            merged.y      = bx::min(group.y, update.y);
+            merged.width  = vertical   ? group.width  : uint16_t(group.width  + update.width );
+            merged.height = horizontal ? group.height : uint16_t(group.height + update.height);
+
+            allocate(merged.data, allocator, merged.width * merged.height * merged.format_size);
+            REQUIRE(
+                merged.data,
+                "Failed to allocate memory for texture update."
+            );
+
+            copy_texture_update(group , merged);
+            copy_texture_update(update, merged);
+
+            group = merged;
+            return;
+        }
+
+        if (overlaps(group, update))
+        {
+            break;
+        }
+    }
+
+    groups.push_back(update);
+}
+
+void TextureUpdateQueue::init()
+{
+    updates  .clear();
+    coalesced.clear();
+}
+
+void TextureUpdateQueue::cleanup()
+{
+    std::vector<TextureUpdate>().swap(updates  );
+    std::vector<TextureUpdate>().swap(coalesced);
+}
+
+void TextureUpdateQueue::add(uint32_t id, const Texture& texture, uint16_t x, uint16_t y, uint16_t width, uint16_t height, uint32_t stride, const void* data, ArenaAllocator& frame_allocator)
+{
+    ASSERT(
+        bgfx::isValid(texture.handle),
+        "Invalid texture."
+    );
+
+    // NOTE : BIMG and BGFX texture format enums match.
+    const bimg::TextureFormat::Enum format = bimg::TextureFormat::Enum(texture.format);
+
+    ASSERT(
+        !bimg::isCompressed(format),
+        "Compressed textures can't be updated."
+    );
+
+    ASSERT(
+        texture.ratio != bgfx::BackbufferRatio::Count ||
+        (x + width <= texture.width && y + height <= texture.height),
+        "Texture update region out of bounds."
+    );
+
+    if (!width || !height || !data)
+    {
+        return;
+    }
+
+    TextureUpdate update = { nullptr, id, bimg::getBitsPerPixel(format) / 8u, x, y, width, height };
+
+    const uint32_t row_size = width * update.format_size;
+
+    allocate(update.data, frame_allocator, row_size * height);
+    REQUIRE(
+        update.data,
+        "Failed to allocate memory for texture update."
+    );
+
+    const uint8_t* src = static_cast<const uint8_t*>(data);
+
+    for (uint16_t i = 0; i < height; i++)
+    {
+        memcpy(update.data + i * row_size, src, row_size);
+
+        src += stride ? stride : row_size;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    updates.push_back(update);
+}
+
+void TextureUpdateQueue::flush(TextureCache& textures, ArenaAllocator& frame_allocator)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    coalesced.clear();
+
+    for (const TextureUpdate& update : updates)
+    {
+        coalesce_texture_update(coalesced, update, frame_allocator);
+    }
+
+    for (const TextureUpdate& update : coalesced)
+    {
+        const Texture& texture = textures[update.id];
+
+        // Texture could have been replaced in the meantime.
+        if (!bgfx::isValid(texture.handle) ||
+            bimg::getBitsPerPixel(bimg::TextureFormat::Enum(texture.format)) / 8u != update.format_size)
+        {
+            continue;
+        }
+
+        const uint32_t pitch = update.width * update.format_size;
+
+        bgfx::updateTexture2D(
+            texture.handle,
+            0,
+            0,
+            update.x,
+            update.y,
+            update.width,
+            update.height,
+            bgfx::makeRef(update.data, pitch * update.height, free_bgfx_memory),
+            uint16_t(pitch)
+        );
+    }
+
+    updates.clear();
+}
+
+static constexpr uint16_t ATLAS_PADDING = 1;
+
+void TextureAtlas::reset(uint16_t width_, uint16_t height_)
+{
+    width  = width_;
+    height = height_;
+
+    skyline.clear();
+    skyline.push_back({ 0, 0, width });
+}
+
+// Returns the lowest Y at which the rectangle fits, starting at given node, or
+// -1 if it doesn't fit at all.
+static int32_t fit_skyline(const std::vector<SkylineNode>& skyline, size_t index, uint16_t width, uint16_t height, uint16_t atlas_width, uint16_t atlas_height)
+{
+    if (skyline[index].x + width > atlas_width)
+    {
+        return -1;
+    }
+
+    int32_t y          = 0;
+    int32_t width_left = width;
+
+    for (size_t i = index; width_left > 0; i++)
+    {
+        y = bx::max(y, int32_t(skyline[i].y));
+
+        if (y + height > atlas_height)
+        {
+            return -1;
+        }
+
+        width_left -= skyline[i].width;
+    }
+
+    return y;
+}
+
+bool TextureAtlas::pack(uint16_t rect_width, uint16_t rect_height, uint16_t& out_x, uint16_t& out_y)
+{
+    int32_t best_y     = INT32_MAX;
+    int32_t best_width = INT32_MAX;
+    size_t  best_index = SIZE_MAX;
+
+    // Lowest top edge wins, narrowest segment breaks ties.
+    for (size_t i = 0; i < skyline.size(); i++)
+    {
+        const int32_t y = fit_skyline(skyline, i, rect_width, rect_height, width, height);
+
+        if (y >= 0 && (y + rect_height < best_y || (y + rect_height == best_y && skyline[i].width < best_width)))
+        {
+            best_y     = y + rect_height;
+            best_width = skyline[i].width;
+            best_index = i;
+        }
+    }
+
+    if (best_index == SIZE_MAX)
+    {
+        return false;
+    }
+
+    out_x = skyline[best_index].x;
+    out_y = uint16_t(best_y - rect_height);
+
+    skyline.insert(skyline.begin() + best_index, { out_x, uint16_t(best_y), rect_width });
+
+    // Shrink or remove the segments now covered by the new one.
+    for (size_t i = best_index + 1; i < skyline.size();)
+    {
+        const SkylineNode& prev  = skyline[i - 1];
+        const int32_t      right = prev.x + prev.width;
+
+        if (skyline[i].x >= right)
+        {
+            break;
+        }
+
+        const int32_t shrink = right - skyline[i].x;
+
+        if (skyline[i].width <= shrink)
+        {
+            skyline.erase(skyline.begin() + i);
+            continue;
+        }
+
+        skyline[i].x     += uint16_t(shrink);
+        skyline[i].width -= uint16_t(shrink);
+
+        break;
+    }
+
+    // Merge neighbouring segments of equal height.
+    for (size_t i = 1; i < skyline.size();)
+    {
+        if (skyline[i - 1].y == skyline[i].y)
+        {
+            skyline[i - 1].width += skyline[i].width;
+            skyline.erase(skyline.begin() + i);
+        }
+        else
+        {
+            i++;
+        }
+    }
+
+    return true;
+}
+
+void TextureAtlasCache::init()
+{
+    for (TextureAtlas& atlas : atlases)
+    {
+        atlas.skyline.clear();
+        atlas.width  = 0;
+        atlas.height = 0;
+    }
+}
+
+void TextureAtlasCache::cleanup()
+{
+    for (TextureAtlas& atlas : atlases)
+    {
+        std::vector<SkylineNode>().swap(atlas.skyline);
+    }
+}
+
+void TextureAtlasCache::reset(uint32_t id, uint16_t width, uint16_t height)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    atlases[id].reset(width, height);
+}
+
+bool TextureAtlasCache::add_image(uint32_t id, const Texture& texture, uint16_t width, uint16_t height, uint32_t stride, const void* data, TextureUpdateQueue& updates, ArenaAllocator& frame_allocator, float* out_uv)
+{
+    ASSERT(
+        data && out_uv,
+        "Invalid atlas image data or output UV rectangle."
+    );
+
+    const uint16_t padded_width  = width  + 2 * ATLAS_PADDING;
+    const uint16_t padded_height = height + 2 * ATLAS_PADDING;
+
+    uint16_t x = 0;
+    uint16_t y = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        TextureAtlas& atlas = atlases[id];
+
+        ASSERT(
+            atlas.width == texture.width && atlas.height == texture.height,
+            "Atlas %" PRIu32 " not created.",
+            id
+        );
+
+        if (!atlas.pack(padded_width, padded_height, x, y))
+        {
+            return false;
+        }
+    }
+
+    // NOTE : BIMG and BGFX texture format enums match.
+    const uint32_t format_size = bimg::getBitsPerPixel(bimg::TextureFormat::Enum(texture.format)) / 8u;
+    const uint32_t row_size    = width * format_size;
+
+    if (!stride)
+    {
+        stride = row_size;
+    }
+
+    // Edge pixels are extruded into the padding, so that the linear filtering
+    // doesn't pick the neighbouring images.
+    uint8_t* padded = nullptr;
+    allocate(padded, frame_allocator, padded_width * padded_height * format_size);
+    REQUIRE(
+        padded,
+        "Failed to allocate memory for atlas image."
+    );
+
+    for (uint16_t i = 0; i < padded_height; i++)
+    {
+        const uint16_t src_y = uint16_t(bx::clamp(int32_t(i) - ATLAS_PADDING, 0, height - 1));
+        const uint8_t* src   = static_cast<const uint8_t*>(data) + src_y * stride;
+        uint8_t*       dst   = padded + i * padded_width * format_size;
+
+        for (uint16_t j = 0; j < ATLAS_PADDING; j++)
+        {
+            memcpy(dst + j * format_size, src, format_size);
+            memcpy(dst + (ATLAS_PADDING + width + j) * format_size, src + row_size - format_size, format_size);
+        }
+
+        memcpy(dst + ATLAS_PADDING * format_size, src, row_size);
+    }
+
+    updates.add(id, texture, x, y, padded_width, padded_height, 0, padded, frame_allocator);
+
+    out_uv[0] = float(x + ATLAS_PADDING         ) / texture.width;
+    out_uv[1] = float(y + ATLAS_PADDING         ) / texture.height;
+    out_uv[2] = float(x + ATLAS_PADDING + width ) / texture.width;
+    out_uv[3] = float(y + ATLAS_PADDING + height) / texture.height;
+
+    return true;
+}
+
+// Targets not requested for this many frames are destroyed.
+static constexpr uint32_t TRANSIENT_TARGET_MAX_IDLE_FRAMES = 3;
+
+void TransientTargetPool::init()
+{
+    targets.clear();
+
+    frame = 0;
+}
+
+void TransientTargetPool::cleanup()
+{
+    for (TransientTarget& target : targets)
+    {
+        target.texture.destroy();
+    }
+
+    std::vector<TransientTarget>().swap(targets);
+}
+
+Texture TransientTargetPool::acquire(uint32_t flags, uint16_t width, uint16_t height, bgfx::ViewId first_pass, bgfx::ViewId last_pass, bool alias, ArenaAllocator& frame_allocator)
+{
+    ASSERT(
+        first_pass <= last_pass && last_pass < MAX_PASSES,
+        "Invalid transient target pass range %" PRIu16 "-%" PRIu16 ".",
+        first_pass,
+        last_pass
+    );
+
+    // Without aliasing, the target is reserved for all the passes.
+    const uint64_t pass_mask = alias
+        ? (uint64_t(2) << last_pass) - (uint64_t(1) << first_pass)
+        : UINT64_MAX;
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    TransientTarget* match = nullptr;
+
+    for (TransientTarget& target : targets)
+    {
+        if (target.flags == flags && target.width == width && target.height == height &&
+            !(target.pass_mask & pass_mask))
+        {
+            match = &target;
+            break;
+        }
+    }
+
+    if (!match)
+    {
+        TransientTarget target = {};
+        target.flags  = flags;
+        target.width  = width;
+        target.height = height;
+
+        target.texture.create({ flags | TEXTURE_TARGET, width, height, 0, nullptr, nullptr, nullptr }, frame_allocator);
+
+        targets.push_back(target);
+
+        match = &targets.back();
+    }
+
+    match->pass_mask  |= pass_mask;
+    match->last_frame  = frame;
+
+    Texture texture = match->texture;
+    texture.readback  = nullptr;
+    texture.size      = 0;
+    texture.evictable = false;
+    texture.transient = true;
+
+    return texture;
+}
+
+void TransientTargetPool::update(uint32_t frame_)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    frame = frame_;
+
+    for (size_t i = 0; i < targets.size();)
+    {
+        TransientTarget& target = targets[i];
+
+        if (frame - target.last_frame > TRANSIENT_TARGET_MAX_IDLE_FRAMES)
+        {
+            target.texture.destroy();
+
+            targets[i] = targets.back();
+            targets.pop_back();
+
+            continue;
+        }
+
+        target.pass_mask = 0;
+
+        i++;
+    }
+}
+
+struct CompressedTextureHeader
+{
+    uint32_t magic;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mip_count;
+    uint32_t size;
+};
+
+static constexpr uint32_t COMPRESSED_TEXTURE_MAGIC = 0x5845544d; // "MTEX"
+
+static bimg::TextureFormat::Enum translate_texture_compression(uint32_t flags)
+{
+    constexpr bimg::TextureFormat::Enum formats[] =
+    {
+        bimg::TextureFormat::Count,
+        bimg::TextureFormat::BC1,
+        bimg::TextureFormat::BC3,
+        bimg::TextureFormat::BC4,
+        bimg::TextureFormat::BC5,
+        bimg::TextureFormat::BC7,
+        bimg::TextureFormat::Count,
+        bimg::TextureFormat::Count,
+    };
+
+    return formats[(flags & TEXTURE_COMPRESSION_MASK) >> TEXTURE_COMPRESSION_SHIFT];
+}
+
+// FNV-1a. Not fast, but negligible compared to the encoding itself.
+static uint64_t hash_bytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+
+    return hash;
+}
+
+static bool read_compressed_texture(const char* path, const CompressedTextureHeader& expected, bimg::ImageContainer& image)
+{
+    FILE* file = fopen(path, "rb");
+
+    if (!file)
+    {
+        return false;
+    }
+
+    CompressedTextureHeader header;
+
+    bool success =
+        fread(&header, sizeof(header), 1, file) == 1    &&
+        header.magic     == expected.magic              &&
+        header.format    == expected.format             &&
+        header.width     == expected.width              &&
+        header.height    == expected.height             &&
+        header.mip_count == expected.mip_count          &&
+        header.size      == image.m_size                &&
+        fread(image.m_data, 1, image.m_size, file) == image.m_size;
+
+    fclose(file);
+
+    return success;
+}
+
+static void write_compressed_texture(const char* path, const CompressedTextureHeader& header, const bimg::ImageContainer& image)
+{
+    // Written under a temporary name first, so that a partially written file
+    // is never picked up.
+    const std::string temp_path = std::string(path) + ".tmp";
+
+    FILE* file = fopen(temp_path.c_str(), "wb");
+
+    if (!file)
+    {
+        WARN(false, "Failed to write compressed texture cache file '%s'.", path);
+        return;
+    }
+
+    const bool success =
+        fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fwrite(image.m_data, 1, image.m_size, file) == image.m_size;
+
+    fclose(file);
+
+    if (!success || rename(temp_path.c_str(), path) != 0)
+    {
+        remove(temp_path.c_str());
+    }
+}
+
+void TextureCompressor::init()
+{
+    cache_dir.clear();
+}
+
+void TextureCompressor::cleanup()
+{
+    std::string().swap(cache_dir);
+}
+
+bimg::ImageContainer* TextureCompressor::compress(const void* data, uint32_t width, uint32_t height, uint32_t stride, uint32_t flags)
+{
+    const bimg::TextureFormat::Enum format = translate_texture_compression(flags);
+
+    if (format == bimg::TextureFormat::Count)
+    {
+        return nullptr;
+    }
+
+    ASSERT(
+        data && width > 0 && height > 0,
+        "Invalid texture compression source."
+    );
+
+    const bool     has_mips = flags & TEXTURE_MIPMAPS;
+    const uint32_t row_size = width * 4;
+
+    if (!stride)
+    {
+        stride = row_size;
+    }
+
+    // Tightly packed source, followed by its mip chain, if requested.
+    std::vector<uint8_t> source(has_mips ? get_mip_chain_size(width, height, 4) : row_size * height);
+
+    for (uint32_t y = 0; y < height; y++)
+    {
+        memcpy(source.data() + y * row_size, static_cast<const uint8_t*>(data) + y * stride, row_size);
+    }
+
+    if (has_mips)
+    {
+        generate_mips(source.data(), width, height, 4);
+    }
+
+    bimg::ImageContainer* image = bimg::imageAlloc(
+        &allocator,
+        format,
+        uint16_t(width),
+        uint16_t(height),
+        0,
+        1,
+        false,
+        has_mips
+    );
+
+    if (!image)
+    {
+        return nullptr;
+    }
+
+    CompressedTextureHeader header = { COMPRESSED_TEXTURE_MAGIC, uint32_t(format), width, height, image->m_numMips, 0 };
+
+    std::string path;
+
+    if (!cache_dir.empty())
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "/%016" PRIx64 ".tex", hash_bytes(source.data(), source.size(), hash_bytes(&header, sizeof(header))));
+
+        path = cache_dir + name;
+
+        if (read_compressed_texture(path.c_str(), header, *image))
+        {
+            return image;
+        }
+    }
+
+    // Levels whose size is not a multiple of the block size are padded by
+    // clamping, so that the encoders never read past the source.
+    std::vector<uint8_t> padded;
+
+    const uint8_t* level        = source.data();
+    uint32_t       level_width  = width;
+    uint32_t       level_height = height;
+
+    for (uint8_t lod = 0; lod < image->m_numMips; lod++)
+    {
+        bimg::ImageMip mip;
+        bimg::imageGetRawData(*image, 0, lod, image->m_data, image->m_size, mip);
+
+        const uint32_t block_width  = (level_width  + 3) & ~3u;
+        const uint32_t block_height = (level_height + 3) & ~3u;
+        const uint8_t* block_source = level;
+
+        if (block_width != level_width || block_height != level_height)
+        {
+            padded.resize(block_width * block_height * 4);
+
+            for (uint32_t y = 0; y < block_height; y++)
+            {
+                const uint8_t* src = level + bx::min(y, level_height - 1) * level_width * 4;
+                uint8_t*       dst = padded.data() + y * block_width * 4;
+
+                for (uint32_t x = 0; x < block_width; x++)
+                {
+                    memcpy(dst + x * 4, src + bx::min(x, level_width - 1) * 4, 4);
+                }
+            }
+
+            block_source = padded.data();
+        }
+
+        bimg::imageEncodeFromRgba8(
+            &allocator,
+            const_cast<uint8_t*>(mip.m_data),
+            block_source,
+            block_width,
+            block_height,
+            1,
+            format,
+            bimg::Quality::Default
+        );
+
+        level       += level_width * level_height * 4;
+        level_width  = bx::max(level_width  >> 1, 1u);
+        level_height = bx::max(level_height >> 1, 1u);
+    }
+
+    if (!path.empty())
+    {
+        header.size = image->m_size;
+
+        write_compressed_texture(path.c_str(), header, *image);
+    }
+
+    return image;
+}
+
+// Neutral grey, so that streamed-in textures don't flash too much.
+static const uint8_t s_placeholder_texel[] = { 0x80, 0x80, 0x80, 0xff };
+
+void TextureStreamer::init()
+{
+    free_requests.clear();
+    decoded      .clear();
+    generations  .fill(0);
+
+    in_flight.store(0, std::memory_order_relaxed);
+
+    for (TextureRequest& request : requests)
+    {
+        free_requests.push_back(&request);
+    }
+}
+
+void TextureStreamer::cleanup()
+{
+    // Tasks can't be cancelled, so the ones still decoding are waited for.
+    while (in_flight.load(std::memory_order_acquire) > 0)
+    {
+        std::this_thread::yield();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for (TextureRequest* request : decoded)
+    {
+        if (request->image)
+        {
+            bimg::imageFree(request->image);
+        }
+    }
+
+    std::vector<TextureRequest*>().swap(free_requests);
+    std::vector<TextureRequest*>().swap(decoded);
+}
+
+TextureRequest* TextureStreamer::request(uint32_t id, uint32_t flags, const char* path, TextureCache& textures, TextureCompressor& compressor, ArenaAllocator& frame_allocator)
+{
+    ASSERT(
+        path && *path,
+        "Invalid texture path."
+    );
+
+    TextureRequest* request = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (free_requests.empty())
+        {
+            WARN(false, "Too many texture requests in flight, '%s' not loaded.", path);
+
+            return nullptr;
+        }
+
+        request = free_requests.back();
+        free_requests.pop_back();
+
+        request->generation = ++generations[id];
+
+        in_flight.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    const uint32_t placeholder_flags = flags & (TEXTURE_SAMPLING_MASK | TEXTURE_BORDER_MASK);
+
+    Texture placeholder;
+    placeholder.create({ placeholder_flags, 1, 1, 0, s_placeholder_texel, nullptr, nullptr }, frame_allocator);
+    placeholder.placeholder = true;
+    placeholder.evictable   = false;
+
+    textures.add_texture(id, placeholder);
+
+    request->streamer   = this;
+    request->compressor = &compressor;
+    request->image      = nullptr;
+    request->path       = path;
+    request->id         = id;
+    request->flags      = flags;
+
+    return request;
+}
+
+void TextureStreamer::cancel(uint32_t id)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    generations[id]++;
+}
+
+void TextureStreamer::complete(TextureRequest* request)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    decoded.push_back(request);
+
+    // Last access to the streamer from the task.
+    in_flight.fetch_sub(1, std::memory_order_release);
+}
+
+void TextureStreamer::update(TextureCache& textures)
+{
+    // NOTE : Meant to be called once per frame from the main thread. Creating
+    //        the textures is cheap, as the decoded images are only referenced.
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for (TextureRequest* request : decoded)
+    {
+        // Newer requests (or synchronous loads) with the same ID win.
+        const bool current = request->generation == generations[request->id];
+
+        WARN(
+            request->image || !current,
+            "Failed to load texture '%s'.",
+            request->path.c_str()
+        );
+
+        if (request->image && current)
+        {
+            Texture texture;
+            texture.create(request->image, request->flags);
+
+            textures.add_texture(request->id, texture);
+        }
+        else if (request->image)
+        {
+            bimg::imageFree(request->image);
+        }
+
+        request->image = nullptr;
+
+        free_requests.push_back(request);
+    }
+
+    decoded.clear();
+}
+
+static bool read_file(const char* path, std::vector<uint8_t>& contents)
+{
+    FILE* file = fopen(path, "rb");
+
+    if (!file)
+    {
+        return false;
+    }
+
+    bool success = fseek(file, 0, SEEK_END) == 0;
+
+    const long size = success ? ftell(file) : -1;
+
+    success = size > 0 && fseek(file, 0, SEEK_SET) == 0;
+
+    if (success)
+    {
+        contents.resize(size_t(size));
+
+        success = fread(contents.data(), 1, contents.size(), file) == contents.size();
+    }
+
+    fclose(file);
+
+    return success;
+}
+
+bimg::ImageContainer* decode_texture(const void* data, uint32_t size, uint32_t flags, TextureCompressor& compressor)
+{
+    uint32_t                        format_size = 0;
+    const bgfx::TextureFormat::Enum format      = translate_texture_format(flags, format_size);
+    const bool                      compress    = flags & TEXTURE_COMPRESSION_MASK;
+
+    // Parsed in the source format, so that block-compressed files (including
+    // their mips) are kept as they are, and only the rest gets converted.
+    bimg::ImageContainer* image = bimg::imageParse(
+        &compressor.allocator,
+        data,
+        size,
+        bimg::TextureFormat::Count
+    );
+
+    if (image && !compress && format_size > 0 && !bimg::isCompressed(image->m_format) &&
+        image->m_format != bimg::TextureFormat::Enum(format))
+    {
+        bimg::ImageContainer* converted = bimg::imageConvert(&compressor.allocator, bimg::TextureFormat::Enum(format), *image);
+
+        bimg::imageFree(image);
+
+        image = converted;
+    }
+
+    if (image && compress && !bimg::isCompressed(image->m_format))
+    {
+        if (image->m_format != bimg::TextureFormat::RGBA8)
+        {
+            bimg::ImageContainer* converted = bimg::imageConvert(&compressor.allocator, bimg::TextureFormat::RGBA8, *image, false);
+
+            bimg::imageFree(image);
+
+            image = converted;
+        }
+
+        if (image)
+        {
+            bimg::ImageContainer* compressed = compressor.compress(image->m_data, image->m_width, image->m_height, 0, flags);
+
+            bimg::imageFree(image);
+
+            image = compressed;
+        }
+    }
+    // Mips are built here as well, so that it's off the main thread.
+    else if (image && !compress && (flags & TEXTURE_MIPMAPS) && format_size > 0 &&
+        image->m_format == bimg::TextureFormat::Enum(format) && image->m_numMips == 1 && !image->m_cubeMap && image->m_depth <= 1 && image->m_numLayers <= 1)
+    {
+        bimg::ImageContainer* mipped = bimg::imageAlloc(
+            &compressor.allocator,
+            image->m_format,
+            uint16_t(image->m_width),
+            uint16_t(image->m_height),
+            0,
+            1,
+            false,
+            true
+        );
+
+        if (mipped)
+        {
+            memcpy(mipped->m_data, image->m_data, image->m_width * image->m_height * format_size);
+
+            generate_mips(static_cast<uint8_t*>(mipped->m_data), image->m_width, image->m_height, format_size);
+
+            bimg::imageFree(image);
+
+            image = mipped;
+        }
+    }
+
+    return image;
+}
+
+void decode_texture_task(void* data)
+{
+    TextureRequest* request = static_cast<TextureRequest*>(data);
+
+    std::vector<uint8_t> contents;
+
+    if (read_file(request->path.c_str(), contents))
+    {
+        request->image = decode_texture(contents.data(), uint32_t(contents.size()), request->flags, *request->compressor);
+    }
+
+    request->streamer->complete(request);
+}
+
+
+// -----------------------------------------------------------------------------
+// INSTANCING
+// -----------------------------------------------------------------------------
+
+static constexpr uint32_t INSTANCE_ALIGNMENT = 16;
+
+static uint32_t get_instance_size(uint32_t type)
+{
+    ASSERT(
+        type <= INSTANCE_DATA_112,
+        "Invalid instance data type %" PRIu32 ".",
+        type
+    );
+
+    return type == INSTANCE_TRANSFORM ? sizeof(hmm_mat4) : type * 16;
+}
+
+static void store_matrix(const hmm_mat4& matrix, void* dst)
+{
+    // NOTE : Both the source and the destination have to be 16-byte aligned.
+    const float* src = &matrix.Elements[0][0];
+    float*       out = static_cast<float*>(dst);
+
+    bx::simd_st(out +  0, bx::simd_ld<bx::simd128_t>(src +  0));
+    bx::simd_st(out +  4, bx::simd_ld<bx::simd128_t>(src +  4));
+    bx::simd_st(out +  8, bx::simd_ld<bx::simd128_t>(src +  8));
+    bx::simd_st(out + 12, bx::simd_ld<bx::simd128_t>(src + 12));
+}
+
+void InstanceRecorder::reset(uint32_t type, std::span<uint8_t> buffer)
+{
+    *this = {};
+
+    instance_size = get_instance_size(type);
+    is_transform  = type == INSTANCE_TRANSFORM;
+
+    allocator.init(buffer, instance_size, INSTANCE_ALIGNMENT);
+}
+
+void InstanceRecorder::push_instance(const hmm_mat4& transform, const void* data)
+{
+    std::span<uint8_t> dst = allocator.allocate();
+    ASSERT(
+        !dst.empty(),
+        "Instance recorder full."
+    );
+
+    if (dst.empty())
+    {
+        return;
+    }
+
+    if (is_transform)
+    {
+        store_matrix(transform, dst.data());
+    }
+    else
+    {
+        memcpy(dst.data(), data, instance_size);
+    }
+
+    instance_count++;
+}
+
+std::span<const uint8_t> InstanceRecorder::buffer() const
+{
+    return { allocator.buffer.data(), instance_size * instance_count };
+}
+
+bool InstanceBuffer::is_valid() const
+{
+    return buffer.num > 0;
+}
+
+void InstanceBuffer::create(uint32_t type, std::span<const uint8_t> data)
+{
+    *this = {};
+
+    const uint32_t size  = get_instance_size(type);
+    const uint32_t count = uint32_t(data.size() / size);
+
+    if (count == 0)
+    {
+        return;
+    }
+
+    const uint32_t available = bgfx::getAvailInstanceDataBuffer(count, uint16_t(size));
+    WARN(
+        available == count,
+        "Failed to allocate enough instance data (%" PRIu32 " out of %" PRIu32 ").",
+        available, count
+    );
+
+    if (available == count)
+    {
+        bgfx::allocInstanceDataBuffer(&buffer, count, uint16_t(size));
+        memcpy(buffer.data, data.data(), buffer.size);
+
+        is_transform = type == INSTANCE_TRANSFORM;
+    }
+}
+
+void InstanceCache::init()
+{
+    *this = {};
+}
+
+void InstanceCache::add_buffer(uint32_t id, const InstanceBuffer& buffer)
+{
+    // NOTE : Not thread safe because users shouldn't create instance buffers
+    //        with the same ID from multiple threads in the first place.
+
+    buffers[id] = buffer;
+}
+
+void InstanceCache::invalidate()
+{
+    // NOTE : Transient BGFX memory is only valid during the current frame.
+    *this = {};
+}
+
+
+// -----------------------------------------------------------------------------
+// MATRIX STACK
+// -----------------------------------------------------------------------------
+
+void multiply_matrices(const hmm_mat4& a, const hmm_mat4& b, hmm_mat4& out)
+{
+    using namespace bx;
+
+    const simd128_t a0 = simd_ld<simd128_t>(a.Elements[0]);
+    const simd128_t a1 = simd_ld<simd128_t>(a.Elements[1]);
+    const simd128_t a2 = simd_ld<simd128_t>(a.Elements[2]);
+    const simd128_t a3 = simd_ld<simd128_t>(a.Elements[3]);
+
+    // Each column is read in full before it's overwritten.
+    for (int i = 0; i < 4; i++)
+    {
+        const float* column = b.Elements[i];
+
+        simd128_t result = simd_mul (a0, simd_splat<simd128_t>(column[0])        );
+                  result = simd_madd(a1, simd_splat<simd128_t>(column[1]), result);
+                  result = simd_madd(a2, simd_splat<simd128_t>(column[2]), result);
+                  result = simd_madd(a3, simd_splat<simd128_t>(column[3]), result);
+
+        simd_st(out.Elements[i], result);
+    }
+}
+
+void MatrixStack::init()
+{
+    top     = HMM_Mat4d(1.0f);
+    top_id  = 0;
+    last_id = 0;
+    size    = 0;
+}
+
+void MatrixStack::push()
+{
+    matrices[size] = top;
+    ids     [size] = top_id;
+
+    size++;
+}
+
+void MatrixStack::pop()
+{
+    size--;
+
+    // Restoring the ID lets the transform cache reuse the earlier registration.
+    top    = matrices[size];
+    top_id = ids     [size];
+}
+
+void MatrixStack::set_top(const hmm_mat4& matrix)
+{
+    top    = matrix;
+    top_id = ++last_id;
+}
+
+void MatrixStack::multiply_top(const hmm_mat4& matrix)
+{
+    multiply_matrices(matrix, top, top);
+
+    top_id = ++last_id;
+}
+
+// The following are exact for any top matrix, but skip the multiplications by
+// the known zeros and ones of the affine transformation.
+
+void MatrixStack::translate(const hmm_vec3& offset)
+{
+    using namespace bx;
+
+    // Each column gets the offset scaled by its W component.
+    const simd128_t t = simd_ld<simd128_t>(offset.X, offset.Y, offset.Z, 0.0f);
+
+    for (int i = 0; i < 4; i++)
+    {
+        const simd128_t column = simd_ld<simd128_t>(top.Elements[i]);
+
+        simd_st(top.Elements[i], simd_madd(t, simd_splat<simd128_t>(top.Elements[i][3]), column));
+    }
+
+    top_id = ++last_id;
+}
+
+void MatrixStack::scale(const hmm_vec3& factor)
+{
+    using namespace bx;
+
+    const simd128_t s = simd_ld<simd128_t>(factor.X, factor.Y, factor.Z, 1.0f);
+
+    for (int i = 0; i < 4; i++)
+    {
+        simd_st(top.Elements[i], simd_mul(s, simd_ld<simd128_t>(top.Elements[i])));
+    }
+
+    top_id = ++last_id;
+}
+
+void MatrixStack::rotate(float angle, const hmm_vec3& axis)
+{
+    using namespace bx;
+
+    const hmm_mat4 rotation = HMM_Rotate(angle, axis);
+
+    const simd128_t r0 = simd_ld<simd128_t>(rotation.Elements[0]);
+    const simd128_t r1 = simd_ld<simd128_t>(rotation.Elements[1]);
+    const simd128_t r2 = simd_ld<simd128_t>(rotation.Elements[2]);
+    const simd128_t w  = simd_ld<simd128_t>(0.0f, 0.0f, 0.0f, 1.0f);
+
+    // Rotation's last column is (0, 0, 0, 1), so the W components stay.
+    for (int i = 0; i < 4; i++)
+    {
+        const float* column = top.Elements[i];
+
+        simd128_t result = simd_mul (w , simd_splat<simd128_t>(column[3])        );
+                  result = simd_madd(r0, simd_splat<simd128_t>(column[0]), result);
+                  result = simd_madd(r1, simd_splat<simd128_t>(column[1]), result);
+                  result = simd_madd(r2, simd_splat<simd128_t>(column[2]), result);
+
+        simd_st(top.Elements[i], result);
+    }
+
+    top_id = ++last_id;
+}
+
+
+// -----------------------------------------------------------------------------
+// VECTOR TRANSFORMS
+// -----------------------------------------------------------------------------
+
+constexpr uint32_t TRANSFORM_CHUNK_SIZE = 16384;
+
+constexpr uint32_t TRANSFORM_MAX_TASKS  = 8;
+
+void transform_vectors(const hmm_mat4& matrix, float w, const void* in, void* out, uint32_t count, uint32_t stride)
+{
+    using namespace bx;
+
+    const simd128_t c0 = simd_ld<simd128_t>(matrix.Elements[0]);
+    const simd128_t c1 = simd_ld<simd128_t>(matrix.Elements[1]);
+    const simd128_t c2 = simd_ld<simd128_t>(matrix.Elements[2]);
+    const simd128_t c3 = simd_mul(simd_ld<simd128_t>(matrix.Elements[3]), simd_splat<simd128_t>(w));
+
+    const uint8_t* src = static_cast<const uint8_t*>(in);
+    uint8_t*       dst = static_cast<uint8_t*>(out);
+
+    alignas(16) float result[4];
+
+    for (uint32_t i = 0; i < count; i++, src += stride, dst += stride)
+    {
+        // Neither alignment nor the fourth component is guaranteed.
+        float vector[3];
+        memcpy(vector, src, sizeof(vector));
+
+        simd128_t value = simd_madd(c0, simd_splat<simd128_t>(vector[0]), c3   );
+                  value = simd_madd(c1, simd_splat<simd128_t>(vector[1]), value);
+                  value = simd_madd(c2, simd_splat<simd128_t>(vector[2]), value);
+
+        simd_st(result, value);
+        memcpy(dst, result, sizeof(vector));
+    }
+}
+
+static bool transform_next_chunk(TransformTask& task)
+{
+    const uint32_t chunk = task.next_chunk.fetch_add(1, std::memory_order_relaxed);
+
+    if (chunk >= task.chunk_count)
+    {
+        return false;
+    }
+
+    const uint32_t first  = chunk * TRANSFORM_CHUNK_SIZE;
+    const size_t   offset = size_t(first) * task.stride;
+
+    transform_vectors(
+        task.matrix,
+        task.w,
+        task.in  + offset,
+        task.out + offset,
+        bx::min(task.count - first, TRANSFORM_CHUNK_SIZE),
+        task.stride
+    );
+
+    task.done_chunks.fetch_add(1, std::memory_order_release);
+
+    return true;
+}
+
+static void release_transform_task(TransformTask* task)
+{
+    if (task->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        delete task;
+    }
+}
+
+void transform_vectors_task(void* data)
+{
+    TransformTask* task = static_cast<TransformTask*>(data);
+
+    while (transform_next_chunk(*task))
+    {
+    }
+
+    release_transform_task(task);
+}
+
+void transform_vectors_parallel(const hmm_mat4& matrix, float w, const void* in, void* out, uint32_t count, uint32_t stride, TaskQueueFunc queue_task)
+{
+    if (!stride)
+    {
+        stride = 3 * sizeof(float);
+    }
+
+    const uint32_t chunk_count = (count + TRANSFORM_CHUNK_SIZE - 1) / TRANSFORM_CHUNK_SIZE;
+
+    if (chunk_count < 2 || !queue_task)
+    {
+        transform_vectors(matrix, w, in, out, count, stride);
+        return;
+    }
+
+    // Heap-allocated, since queued tasks may only start after all the work is
+    // done and this function has returned.
+    TransformTask* task = new TransformTask{
+        matrix,
+        w,
+        static_cast<const uint8_t*>(in),
+        static_cast<uint8_t*>(out),
+        count,
+        stride,
+        chunk_count,
+        { 0 },
+        { 0 },
+        { 1 },
+    };
+
+    const uint32_t task_count = bx::min(chunk_count - 1, TRANSFORM_MAX_TASKS);
+
+    for (uint32_t i = 0; i < task_count; i++)
+    {
+        task->references.fetch_add(1, std::memory_order_relaxed);
+
+        if (!queue_task(transform_vectors_task, task))
+        {
+            task->references.fetch_sub(1, std::memory_order_relaxed);
+            break;
+        }
+    }
+
+    // The calling thread works too, so it never waits on a task that hasn't
+    // started (which would deadlock when called from a saturated task pool).
+    while (transform_next_chunk(*task))
+    {
+    }
+
+    while (task->done_chunks.load(std::memory_order_acquire) < chunk_count)
+    {
+        std::this_thread::yield();
+    }
+
+    release_transform_task(task);
+}
+
+
+// -----------------------------------------------------------------------------
+// TRANSFORM CACHE
+// -----------------------------------------------------------------------------
+
+void TransformCache::reset()
+{
+    // NOTE : BGFX transform cache indices are only valid in the current frame.
+    entries.fill({ UINT32_MAX, UINT32_MAX });
+}
+
+uint32_t TransformCache::add(bgfx::Encoder& encoder, const hmm_mat4* matrices, uint16_t count)
+{
+    bgfx::Transform transform;
+    const uint32_t  index = encoder.allocTransform(&transform, count);
+
+    WARN(
+        transform.num == count,
+        "Failed to allocate %" PRIu16 " transforms.",
+        count
+    );
+
+    if (transform.num != count)
+    {
+        return UINT32_MAX;
+    }
+
+    memcpy(transform.data, matrices, count * sizeof(hmm_mat4));
+
+    return index;
+}
+
+uint32_t TransformCache::get(bgfx::Encoder& encoder, const MatrixStack& stack)
+{
+    CachedTransform& entry = entries[stack.top_id % entries.size()];
+
+    if (entry.matrix_id != stack.top_id || entry.index == UINT32_MAX)
+    {
+        entry.matrix_id = stack.top_id;
+        entry.index     = add(encoder, &stack.top, 1);
+    }
+
+    return entry.index;
+}
+
+
+// -----------------------------------------------------------------------------
+// OCCLUSION CULLING
+// -----------------------------------------------------------------------------
+
+static constexpr uint32_t OCCLUSION_ROW_ITEMS    = OCCLUSION_BUFFER_WIDTH / 4;
+static constexpr uint32_t OCCLUSION_BAND_HEIGHT  = OCCLUSION_BUFFER_HEIGHT / OCCLUSION_BAND_COUNT;
+static constexpr uint32_t OCCLUSION_TILES_X      = OCCLUSION_BUFFER_WIDTH  / OCCLUSION_TILE_SIZE;
+static constexpr uint32_t OCCLUSION_TILES_Y      = OCCLUSION_BUFFER_HEIGHT / OCCLUSION_TILE_SIZE;
+static constexpr float    OCCLUSION_MIN_W        = 1e-5f;
+
+static_assert(
+    OCCLUSION_BUFFER_WIDTH % OCCLUSION_TILE_SIZE == 0 && OCCLUSION_TILE_SIZE % 4 == 0,
+    "Occlusion buffer rows must consist of whole tiles and SIMD items."
+);
+
+static_assert(
+    OCCLUSION_BAND_HEIGHT % OCCLUSION_TILE_SIZE == 0,
+    "Occlusion bands must consist of whole tile rows."
+);
+
+// Returns `false` if the point is behind the near plane (no clipping is done).
+static bool project_to_occlusion_buffer(const hmm_mat4& transform, const hmm_vec3& position, hmm_vec4& screen)
+{
+    const hmm_vec4 clip = transform * HMM_Vec4(position.X, position.Y, position.Z, 1.0f);
+
+    if (clip.W < OCCLUSION_MIN_W)
+    {
+        return false;
+    }
+
+    const float inv_w = 1.0f / clip.W;
+
+    screen = HMM_Vec4(
+        (0.5f + 0.5f * clip.X * inv_w) * OCCLUSION_BUFFER_WIDTH,
+        (0.5f - 0.5f * clip.Y * inv_w) * OCCLUSION_BUFFER_HEIGHT,
+        clip.Z * inv_w,
+        1.0f
+    );
+
+    return true;
+}
+
+void OcclusionBuffer::init()
+{
+    occluders      .clear();
+    screen_vertices.clear();
+    depth          .resize(OCCLUSION_ROW_ITEMS * OCCLUSION_BUFFER_HEIGHT);
+    tile_depth     .resize(OCCLUSION_TILES_X   * OCCLUSION_TILES_Y      );
+
+    view_proj = HMM_Mat4d(1.0f);
+
+    pending_bands.store(0         , std::memory_order_relaxed);
+    pass         .store(UINT16_MAX, std::memory_order_relaxed);
+    ready        .store(false     , std::memory_order_relaxed);
+}
+
+void OcclusionBuffer::cleanup()
+{
+    std::vector<Occluder     >().swap(occluders      );
+    std::vector<hmm_vec4     >().swap(screen_vertices);
+    std::vector<bx::simd128_t>().swap(depth          );
+    std::vector<float        >().swap(tile_depth     );
+}
+
+void OcclusionBuffer::begin(bgfx::ViewId pass_, const hmm_mat4& view_proj_)
+{
+    ASSERT(
+        pending_bands.load(std::memory_order_acquire) == 0,
+        "Occlusion buffer still being rasterized."
+    );
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    occluders.clear();
+
+    // Draws are not tested against the buffer until `end` publishes it again.
+    ready.store(false, std::memory_order_release);
+
+    view_proj = view_proj_;
+
+    pass.store(pass_, std::memory_order_release);
+}
+
+void OcclusionBuffer::add_occluder(const hmm_mat4& transform, const std::vector<hmm_vec3>& triangles)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    occluders.push_back({ transform, &triangles });
+}
+
+void OcclusionBuffer::end()
+{
+    // Occluder vertices are projected once, so that the bands don't have to
+    // repeat it. Triangles with a vertex behind the near plane are dropped,
+    // which only makes the buffer more conservative.
+    screen_vertices.clear();
+
+    for (const Occluder& occluder : occluders)
+    {
+        const hmm_mat4 transform = view_proj * occluder.transform;
+        const std::vector<hmm_vec3>& triangles = *occluder.triangles;
+
+        for (size_t i = 0; i + 2 < triangles.size(); i += 3)
+        {
+            hmm_vec4 screen[3];
+
+            if (project_to_occlusion_buffer(transform, triangles[i    ], screen[0]) &&
+                project_to_occlusion_buffer(transform, triangles[i + 1], screen[1]) &&
+                project_to_occlusion_buffer(transform, triangles[i + 2], screen[2]))
+            {
+                screen_vertices.insert(screen_vertices.end(), screen, screen + 3);
+            }
+        }
+    }
+
+    // NOTE : Each band has to be rasterized afterwards, either directly or via
+    //        `rasterize_occlusion_band` tasks.
+    pending_bands.store(OCCLUSION_BAND_COUNT, std::memory_order_relaxed);
+    ready        .store(true                , std::memory_order_release);
+}
+
+void OcclusionBuffer::rasterize(uint32_t band)
+{
+    using namespace bx;
+
+    const int band_y0 = int(band * OCCLUSION_BAND_HEIGHT);
+    const int band_y1 = int(band_y0 + OCCLUSION_BAND_HEIGHT) - 1;
+
+    const simd128_t far_depth = simd_splat<simd128_t>(FLT_MAX);
+    const simd128_t zero      = simd_zero <simd128_t>();
+    const simd128_t x_offsets = simd_ld   <simd128_t>(0.5f, 1.5f, 2.5f, 3.5f);
+
+    for (int y = band_y0; y <= band_y1; y++)
+    {
+        for (uint32_t i = 0; i < OCCLUSION_ROW_ITEMS; i++)
+        {
+            depth[y * OCCLUSION_ROW_ITEMS + i] = far_depth;
+        }
+    }
+
+    for (size_t i = 0; i + 2 < screen_vertices.size(); i += 3)
+    {
+        hmm_vec4 v0 = screen_vertices[i    ];
+        hmm_vec4 v1 = screen_vertices[i + 1];
+        hmm_vec4 v2 = screen_vertices[i + 2];
+
+        float area = (v1.X - v0.X) * (v2.Y - v0.Y) - (v1.Y - v0.Y) * (v2.X - v0.X);
+
+        // Both windings occlude.
+        if (area < 0.0f)
+        {
+            bx::swap(v1, v2);
+            area = -area;
+        }
+
+        if (area < 1e-6f)
+        {
+            continue;
+        }
+
+        const float bounds_min_x = bx::min(v0.X, bx::min(v1.X, v2.X));
+        const float bounds_max_x = bx::max(v0.X, bx::max(v1.X, v2.X));
+        const float bounds_min_y = bx::min(v0.Y, bx::min(v1.Y, v2.Y));
+        const float bounds_max_y = bx::max(v0.Y, bx::max(v1.Y, v2.Y));
+
+        // Rejected and clamped before the conversion, as vertices close to
+        // the camera plane can project far outside of the `int` range.
+        if (bounds_max_x < 0.0f || bounds_min_x > float(OCCLUSION_BUFFER_WIDTH - 1) ||
+            bounds_max_y < float(band_y0) || bounds_min_y > float(band_y1))
+        {
+            continue;
+        }
+
+        const int min_x = int(bx::max(bounds_min_x, 0.0f)) & ~3;
+        const int max_x = int(bx::min(bounds_max_x, float(OCCLUSION_BUFFER_WIDTH - 1)));
+        const int min_y = int(bx::max(bounds_min_y, float(band_y0)));
+        const int max_y = int(bx::min(bounds_max_y, float(band_y1)));
+
+        // Edge functions `a * x + b * y + c`, positive inside the triangle.
+        const hmm_vec4* v[3] = { &v0, &v1, &v2 };
+        float           a[3];
+        float           b[3];
+        float           c[3];
+
+        for (int e = 0; e < 3; e++)
+        {
+            const hmm_vec4& p = *v[(e + 1) % 3];
+            const hmm_vec4& q = *v[(e + 2) % 3];
+
+            a[e] = p.Y - q.Y;
+            b[e] = q.X - p.X;
+            c[e] = p.X * q.Y - p.Y * q.X;
+        }
+
+        // Depth plane `z = dzdx * x + dzdy * y + z0`, from the barycentrics.
+        const float inv_area = 1.0f / area;
+        const float dzdx     = (a[0] * v0.Z + a[1] * v1.Z + a[2] * v2.Z) * inv_area;
+        const float dzdy     = (b[0] * v0.Z + b[1] * v1.Z + b[2] * v2.Z) * inv_area;
+        const float z0       = (c[0] * v0.Z + c[1] * v1.Z + c[2] * v2.Z) * inv_area;
+
+        const simd128_t a0 = simd_splat<simd128_t>(a[0]);
+        const simd128_t a1 = simd_splat<simd128_t>(a[1]);
+        const simd128_t a2 = simd_splat<simd128_t>(a[2]);
+        const simd128_t az = simd_splat<simd128_t>(dzdx);
+
+        for (int y = min_y; y <= max_y; y++)
+        {
+            const float py = float(y) + 0.5f;
+
+            const simd128_t c0 = simd_splat<simd128_t>(b[0] * py + c[0]);
+            const simd128_t c1 = simd_splat<simd128_t>(b[1] * py + c[1]);
+            const simd128_t c2 = simd_splat<simd128_t>(b[2] * py + c[2]);
+            const simd128_t cz = simd_splat<simd128_t>(dzdy * py + z0  );
+
+            for (int x = min_x; x <= max_x; x += 4)
+            {
+                const simd128_t px = simd_add(simd_splat<simd128_t>(float(x)), x_offsets);
+
+                const simd128_t e0 = simd_madd(a0, px, c0);
+                const simd128_t e1 = simd_madd(a1, px, c1);
+                const simd128_t e2 = simd_madd(a2, px, c2);
+
+                const simd128_t inside = simd_and(
+                    simd_cmpge(e0, zero),
+                    simd_and(simd_cmpge(e1, zero), simd_cmpge(e2, zero))
+                );
+
+                if (!simd_test_any_xyzw(inside))
+                {
+                    continue;
+                }
+
+                simd128_t& item = depth[y * OCCLUSION_ROW_ITEMS + x / 4];
+
+                const simd128_t z = simd_madd(az, px, cz);
+
+                item = simd_selb(inside, simd_min(z, item), item);
+            }
+        }
+    }
+
+    // Farthest depth per tile, used by the visibility tests.
+    const uint32_t tile_y0 = band_y0 / OCCLUSION_TILE_SIZE;
+    const uint32_t tile_y1 = tile_y0 + OCCLUSION_BAND_HEIGHT / OCCLUSION_TILE_SIZE;
+
+    for (uint32_t ty = tile_y0; ty < tile_y1; ty++)
+    {
+        for (uint32_t tx = 0; tx < OCCLUSION_TILES_X; tx++)
+        {
+            simd128_t farthest = simd_splat<simd128_t>(-FLT_MAX);
+
+            for (uint32_t y = 0; y < OCCLUSION_TILE_SIZE; y++)
+            {
+                const uint32_t row = (ty * OCCLUSION_TILE_SIZE + y) * OCCLUSION_ROW_ITEMS;
+
+                for (uint32_t x = 0; x < OCCLUSION_TILE_SIZE / 4; x++)
+                {
+                    farthest = simd_max(farthest, depth[row + tx * OCCLUSION_TILE_SIZE / 4 + x]);
+                }
+            }
+
+            float values[4];
+            simd_st(values, farthest);
+
+            tile_depth[ty * OCCLUSION_TILES_X + tx] = bx::max(bx::max(values[0], values[1]), bx::max(values[2], values[3]));
+        }
+    }
+
+    // Publishes the band's depth to the threads testing visibility.
+    pending_bands.fetch_sub(1, std::memory_order_release);
+}
+
+bool OcclusionBuffer::is_visible(const hmm_mat4& transform, const hmm_vec3& bounds_min, const hmm_vec3& bounds_max) const
+{
+    if (!ready.load(std::memory_order_acquire) || pending_bands.load(std::memory_order_acquire) != 0)
+    {
+        return true;
+    }
+
+    const hmm_mat4 mvp = view_proj * transform;
+
+    float min_x = FLT_MAX;
+    float min_y = FLT_MAX;
+    float max_x = -FLT_MAX;
+    float max_y = -FLT_MAX;
+    float min_z = FLT_MAX;
+
+    for (int i = 0; i < 8; i++)
+    {
+        const hmm_vec3 corner = HMM_Vec3(
+            (i & 1) ? bounds_max.X : bounds_min.X,
+            (i & 2) ? bounds_max.Y : bounds_min.Y,
+            (i & 4) ? bounds_max.Z : bounds_min.Z
+        );
+
+        hmm_vec4 screen;
+
+        // Boxes crossing the near plane are never culled.
+        if (!project_to_occlusion_buffer(mvp, corner, screen))
+        {
+            return true;
+        }
+
+        min_x = bx::min(min_x, screen.X);
+        min_y = bx::min(min_y, screen.Y);
+        max_x = bx::max(max_x, screen.X);
+        max_y = bx::max(max_y, screen.Y);
+        min_z = bx::min(min_z, screen.Z);
+    }
+
+    // NOTE : Boxes outside of the buffer are left to the GPU, frustum culling
+    //        isn't this function's business.
+    if (max_x < 0.0f || max_y < 0.0f || min_x >= OCCLUSION_BUFFER_WIDTH || min_y >= OCCLUSION_BUFFER_HEIGHT)
+    {
+        return true;
+    }
+
+    // Clamped before the conversion, as projected values can be arbitrarily big.
+    const uint32_t tile_x0 = uint32_t(bx::max(min_x, 0.0f)) / OCCLUSION_TILE_SIZE;
+    const uint32_t tile_y0 = uint32_t(bx::max(min_y, 0.0f)) / OCCLUSION_TILE_SIZE;
+    const uint32_t tile_x1 = uint32_t(bx::min(max_x, float(OCCLUSION_BUFFER_WIDTH  - 1))) / OCCLUSION_TILE_SIZE;
+    const uint32_t tile_y1 = uint32_t(bx::min(max_y, float(OCCLUSION_BUFFER_HEIGHT - 1))) / OCCLUSION_TILE_SIZE;
+
+    for (uint32_t ty = tile_y0; ty <= tile_y1; ty++)
+    {
+        for (uint32_t tx = tile_x0; tx <= tile_x1; tx++)
+        {
+            if (tile_depth[ty * OCCLUSION_TILES_X + tx] >= min_z)
+            {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+void rasterize_occlusion_band(void* data)
+{
+    const OcclusionTask* task = static_cast<const OcclusionTask*>(data);
+
+    task->buffer->rasterize(task->band);
+}
+
+
+// -----------------------------------------------------------------------------
+// PASSES
+// -----------------------------------------------------------------------------
+
+static void get_backbuffer_ratio_size(bgfx::BackbufferRatio::Enum ratio, uint16_t backbuffer_width, uint16_t backbuffer_height, uint16_t& out_width, uint16_t& out_height)
+{
+    // Same as BGFX's internal computation.
+    uint32_t width  = backbuffer_width;
+    uint32_t height = backbuffer_height;
+
+    switch (ratio)
+    {
+    case bgfx::BackbufferRatio::Half:      width /=  2; height /=  2; break;
+    case bgfx::BackbufferRatio::Quarter:   width /=  4; height /=  4; break;
+    case bgfx::BackbufferRatio::Eighth:    width /=  8; height /=  8; break;
+    case bgfx::BackbufferRatio::Sixteenth: width /= 16; height /= 16; break;
+    case bgfx::BackbufferRatio::Double:    width *=  2; height *=  2; break;
+    default:                                                          break;
+    }
+
+    out_width  = uint16_t(bx::max(width , 1u));
+    out_height = uint16_t(bx::max(height, 1u));
+}
+
+void Pass::init()
+{
+    view_matrix     = HMM_Mat4d(1.0f);
+    proj_matrix     = HMM_Mat4d(1.0f);
+
+    viewport_x      = 0;
+    viewport_y      = 0;
+    viewport_width  = SIZE_EQUAL;
+    viewport_height = SIZE_EQUAL;
+
+    framebuffer     = BGFX_INVALID_HANDLE;
+
+    clear_flags     = BGFX_CLEAR_NONE;
+    clear_depth     = 1.0f;
+    clear_rgba      = 0x000000ff;
+    clear_stencil   = 0;
+
+    dirty_flags     = DIRTY_CLEAR;
+
+    resolution_scale = 1.0f;
+
+    reads .reset();
+    writes.reset();
+    output          = false;
+}
+
+void Pass::update(bgfx::ViewId id, bool backbuffer_size_changed)
+{
+    if (dirty_flags == DIRTY_NONE && !backbuffer_size_changed)
+    {
+        return;
+    }
+
+    if (dirty_flags & DIRTY_TOUCH)
+    {
+        bgfx::touch(id);
+    }
+
+    if (dirty_flags & DIRTY_CLEAR)
+    {
+        bgfx::setViewClear(id, clear_flags, clear_rgba, clear_depth, clear_stencil);
+    }
+
+    if (dirty_flags & DIRTY_TRANSFORM)
+    {
+        bgfx::setViewTransform(id, &view_matrix, &proj_matrix);
+    }
+
+    if ((dirty_flags & DIRTY_RECT) || (backbuffer_size_changed && viewport_width >= SIZE_EQUAL))
+    {
+        if (resolution_scale != 1.0f)
+        {
+            uint16_t width  = viewport_width;
+            uint16_t height = viewport_height;
+
+            if (viewport_width >= SIZE_EQUAL)
+            {
+                const bgfx::Stats* stats = bgfx::getStats();
+
+                get_backbuffer_ratio_size(bgfx::BackbufferRatio::Enum(viewport_width - SIZE_EQUAL), stats->width, stats->height, width, height);
+            }
+
+            width  = uint16_t(bx::max(1.0f, width  * resolution_scale + 0.5f));
+            height = uint16_t(bx::max(1.0f, height * resolution_scale + 0.5f));
+
+            bgfx::setViewRect(id, viewport_x, viewport_y, width, height);
+        }
+        else if (viewport_width >= SIZE_EQUAL)
+        {
+            bgfx::setViewRect(id, viewport_x, viewport_y, bgfx::BackbufferRatio::Enum(viewport_width - SIZE_EQUAL));
+        }
+        else
+        {
+            bgfx::setViewRect(id, viewport_x, viewport_y, viewport_width, viewport_height);
+        }
+    }
+
+    if ((dirty_flags & DIRTY_FRAMEBUFFER) || backbuffer_size_changed)
+    {
+        // Having `BGFX_INVALID_HANDLE` here is OK.
+        bgfx::setViewFrameBuffer(id, framebuffer);
+    }
+
+    dirty_flags = DIRTY_NONE;
+}
+
+void Pass::set_resolution_scale(float scale)
+{
+    if (resolution_scale != scale)
+    {
+        resolution_scale  = scale;
+        dirty_flags      |= DIRTY_RECT;
+    }
+}
+
+bool Pass::in_graph() const
+{
+    return output || reads.any() || writes.any();
+}
+
+void Pass::touch()
+{
+    dirty_flags |= DIRTY_TOUCH;
+}
+
+void Pass::set_view(const hmm_mat4& matrix)
+{
+    view_matrix  = matrix;
+    dirty_flags |= DIRTY_TRANSFORM;
+}
+
+void Pass::set_projection(const hmm_mat4& matrix)
+{
+    proj_matrix  = matrix;
+    dirty_flags |= DIRTY_TRANSFORM;
+}
+
+void Pass::set_framebuffer(bgfx::FrameBufferHandle framebuffer_)
+{
+    framebuffer  = framebuffer_;
+    dirty_flags |= DIRTY_FRAMEBUFFER;
+}
+
+void Pass::set_no_clear()
+{
+    clear_flags  = BGFX_CLEAR_NONE;
+    dirty_flags |= DIRTY_CLEAR;
+}
+
+void Pass::set_clear_depth(float depth)
+{
+    clear_flags |= BGFX_CLEAR_DEPTH;
+    clear_depth  = depth;
+    dirty_flags |= DIRTY_CLEAR;
+}
+
+void Pass::set_clear_color(uint32_t rgba)
+{
+    clear_flags |= BGFX_CLEAR_COLOR;
+    clear_rgba   = rgba;
+    dirty_flags |= DIRTY_CLEAR;
+}
+
+void Pass::set_viewport(uint16_t x, uint16_t y, uint16_t width, uint16_t height)
+{
+    ASSERT(
+        width < SIZE_EQUAL || width == height,
+        "Symbolic viewport size must be the same in bot X and Y axes."
+    );
+
+    viewport_x      = x;
+    viewport_y      = y;
+    viewport_width  = width;
+    viewport_height = height;
+    dirty_flags    |= DIRTY_RECT;
+}
+
+void PassCache::init()
+{
+    for (Pass& pass : passes)
+    {
+        pass.init();
+    }
+
+    for (bgfx::ViewId id = 0; id < MAX_PASSES; id++)
+    {
+        order[id] = id;
+    }
+
+    active_mask             = UINT64_MAX;
+    backbuffer_size_changed = true;
+    graph_enabled           = false;
+    order_changed           = false;
+}
+
+void PassCache::update()
+{
+    PROFILE_ZONE("PassCache::update");
+
+    if (graph_enabled)
+    {
+        compile_graph();
+    }
+
+    for (bgfx::ViewId id = 0; id < passes.size(); id++)
+    {
+        Pass& pass = passes[id];
+
+        if (is_active(id))
+        {
+            pass.update(id, backbuffer_size_changed);
+        }
+        else if (backbuffer_size_changed)
+        {
+            // Applied once the pass becomes active again.
+            pass.dirty_flags |= Pass::DIRTY_RECT | Pass::DIRTY_FRAMEBUFFER;
+        }
+    }
+
+    if (order_changed)
+    {
+        bgfx::setViewOrder(0, MAX_PASSES, graph_enabled ? order.data() : nullptr);
+
+        order_changed = false;
+    }
+
+    backbuffer_size_changed = false;
+}
+
+void PassCache::enable_graph(bool enabled)
+{
+    if (graph_enabled == enabled)
+    {
+        return;
+    }
+
+    graph_enabled = enabled;
+    order_changed = true;
+    active_mask   = UINT64_MAX;
+
+    for (bgfx::ViewId id = 0; id < MAX_PASSES; id++)
+    {
+        order[id] = id;
+    }
+}
+
+bool PassCache::is_active(bgfx::ViewId id) const
+{
+    return active_mask & (uint64_t(1) << id);
+}
+
+void PassCache::set_resolution_scale(uint64_t pass_mask, float scale)
+{
+    for (bgfx::ViewId id = 0; id < MAX_PASSES; id++)
+    {
+        passes[id].set_resolution_scale((pass_mask & (uint64_t(1) << id)) ? scale : 1.0f);
+    }
+}
+
+void PassCache::compile_graph()
+{
+    // Latest writer and readers since then, for each texture.
+    std::array<int8_t  , MAX_TEXTURES> last_writer;
+    std::array<uint64_t, MAX_TEXTURES> readers;
+    std::array<uint64_t, MAX_PASSES  > dependencies;
+
+    last_writer .fill(-1);
+    readers     .fill(0);
+    dependencies.fill(0);
+
+    uint64_t graph_mask  = 0;
+    uint64_t output_mask = 0;
+
+    for (uint32_t id = 0; id < MAX_PASSES; id++)
+    {
+        const Pass&    pass = passes[id];
+        const uint64_t bit  = uint64_t(1) << id;
+
+        if (!pass.in_graph())
+        {
+            continue;
+        }
+
+        // Passes rendering into the same framebuffer (or the backbuffer) keep
+        // their relative order, as the later ones draw over the earlier ones.
+        for (int32_t other = int32_t(id) - 1; other >= 0; other--)
+        {
+            if ((graph_mask & (uint64_t(1) << other)) &&
+                passes[other].framebuffer.idx == pass.framebuffer.idx)
+            {
+                dependencies[id] |= uint64_t(1) << other;
+                break;
+            }
+        }
+
+        graph_mask |= bit;
+
+        if (pass.output || !bgfx::isValid(pass.framebuffer))
+        {
+            output_mask |= bit;
+        }
+
+        for (uint32_t texture = 0; texture < MAX_TEXTURES; texture++)
+        {
+            if (pass.reads[texture])
+            {
+                if (last_writer[texture] >= 0)
+                {
+                    dependencies[id] |= uint64_t(1) << last_writer[texture];
+                }
+
+                readers[texture] |= bit;
+            }
+        }
+
+        for (uint32_t texture = 0; texture < MAX_TEXTURES; texture++)
+        {
+            if (pass.writes[texture])
+            {
+                if (last_writer[texture] >= 0)
+                {
+                    dependencies[id] |= uint64_t(1) << last_writer[texture];
+                }
+
+                dependencies[id]     |= readers[texture] & ~bit;
+                readers[texture]      = 0;
+                last_writer[texture]  = int8_t(id);
+            }
+        }
+    }
+
+    // Everything the outputs (transitively) depend on stays.
+    uint64_t live = output_mask;
+
+    for (uint64_t previous = 0; previous != live;)
+    {
+        previous = live;
+
+        for (uint32_t id = 0; id < MAX_PASSES; id++)
+        {
+            if (live & (uint64_t(1) << id))
+            {
+                live |= dependencies[id];
+            }
+        }
+    }
+
+    // Dependencies only point to lower IDs, so there are no cycles. Of the
+    // ready passes, the one sharing the framebuffer with the previous wins.
+    std::array<bgfx::ViewId, MAX_PASSES> schedule;
+    uint32_t                             count       = 0;
+    uint64_t                             remaining   = live;
+    uint16_t                             framebuffer = bgfx::kInvalidHandle;
+
+    while (remaining)
+    {
+        int32_t next = -1;
+
+        for (uint32_t id = 0; id < MAX_PASSES; id++)
+        {
+            if (!(remaining & (uint64_t(1) << id)) || (dependencies[id] & remaining))
+            {
+                continue;
+            }
+
+            if (next < 0)
+            {
+                next = int32_t(id);
+            }
+
+            if (passes[id].framebuffer.idx == framebuffer)
+            {
+                next = int32_t(id);
+                break;
+            }
+        }
+
+        ASSERT(
+            next >= 0,
+            "Render graph cycle."
+        );
+
+        schedule[count++] = bgfx::ViewId(next);
+        remaining        &= ~(uint64_t(1) << next);
+        framebuffer       = passes[next].framebuffer.idx;
+    }
+
+    // Culled passes go after the live ones, into the slots of the graph passes.
+    for (uint32_t id = 0; id < MAX_PASSES; id++)
+    {
+        if ((graph_mask & ~live) & (uint64_t(1) << id))
+        {
+            schedule[count++] = bgfx::ViewId(id);
+        }
+    }
+
+    std::array<bgfx::ViewId, MAX_PASSES> new_order;
+
+    for (uint32_t id = 0, slot = 0; id < MAX_PASSES; id++)
+    {
+        new_order[id] = (graph_mask & (uint64_t(1) << id)) ? schedule[slot++] : bgfx::ViewId(id);
+    }
+
+    if (new_order != order)
+    {
+        order         = new_order;
+        order_changed = true;
+    }
+
+    active_mask = ~graph_mask | live;
+}
+
+
+// -----------------------------------------------------------------------------
+// TIME MEASUREMENT
+// -----------------------------------------------------------------------------
+
+static const double s_timer_inv_frequency = 1.0 / double(bx::getHPFrequency());
+
+void Timer::tic()
+{
+    tic(bx::getHPCounter());
+}
+
+void Timer::tic(int64_t now)
+{
+    counter = now;
+}
+
+double Timer::toc(bool restart)
+{
+    return toc(bx::getHPCounter(), restart);
+}
+
+double Timer::toc(int64_t now, bool restart)
+{
+    elapsed = (now - counter) * s_timer_inv_frequency;
+
+    if (restart)
+    {
+        counter = now;
+    }
+
+    return elapsed;
+}
+
+
+// -----------------------------------------------------------------------------
+// PROFILER
+// -----------------------------------------------------------------------------
+
+Profiler g_profiler;
+
+// Stale once the generation differs (the record was freed in `cleanup`).
+static thread_local ProfilerThread* s_profiler_thread            = nullptr;
+static thread_local uint32_t        s_profiler_thread_generation = 0;
+
+void Profiler::cleanup()
+{
+    enabled.store(false, std::memory_order_relaxed);
+
+    for (std::atomic<ProfilerThread*>& thread : threads)
+    {
+        delete thread.exchange(nullptr);
+    }
+
+    thread_count.store(0, std::memory_order_relaxed);
+
+    generation.fetch_add(1, std::memory_order_release);
+}
+
+ProfilerThread* Profiler::current_thread()
+{
+    const uint32_t current_generation = generation.load(std::memory_order_acquire);
+
+    if (s_profiler_thread && s_profiler_thread_generation == current_generation)
+    {
+        return s_profiler_thread;
+    }
+
+    uint32_t id = thread_count.load(std::memory_order_relaxed);
+
+    do
+    {
+        if (id >= PROFILER_MAX_THREADS)
+        {
+            return nullptr;
+        }
+    }
+    while (!thread_count.compare_exchange_weak(id, id + 1, std::memory_order_relaxed));
+
+    ProfilerThread* thread = new ProfilerThread();
+    thread->id = id;
+
+    threads[id].store(thread, std::memory_order_release);
+
+    s_profiler_thread_generation = current_generation;
+
+    return s_profiler_thread = thread;
+}
+
+void Profiler::begin_zone(const char* name)
+{
+    if (!enabled.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+
+    ProfilerThread* thread = current_thread();
+
+    if (!thread)
+    {
+        return;
+    }
+
+    // Too deep zones only keep the nesting balanced.
+    if (thread->depth < PROFILER_MAX_DEPTH)
+    {
+        thread->open_zones[thread->depth] = { name, bx::getHPCounter(), 0 };
+    }
+
+    thread->depth++;
+}
+
+void Profiler::end_zone()
+{
+    // Not checking `enabled`, so that zones started before disabling finish.
+    ProfilerThread* thread = s_profiler_thread;
+
+    if (!thread || !thread->depth ||
+        s_profiler_thread_generation != generation.load(std::memory_order_acquire))
+    {
+        return;
+    }
+
+    thread->depth--;
+
+    if (thread->depth < PROFILER_MAX_DEPTH)
+    {
+        const uint32_t head = thread->head.load(std::memory_order_relaxed);
+
+        ProfilerZone& zone = thread->zones[head & (PROFILER_RING_SIZE - 1)];
+        zone     = thread->open_zones[thread->depth];
+        zone.end = bx::getHPCounter();
+
+        thread->head.store(head + 1, std::memory_order_release);
+    }
+}
+
+static void write_json_string(FILE* file, const char* string)
+{
+    fputc('"', file);
+
+    for (const char* c = string; *c; c++)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            fputc('\\', file);
+            fputc(*c, file);
+        }
+        else if (uint8_t(*c) < 0x20)
+        {
+            fprintf(file, "\\u%04x", uint8_t(*c));
+        }
+        else
+        {
+            fputc(*c, file);
+        }
+    }
+
+    fputc('"', file);
+}
+
+bool Profiler::dump(const char* path)
+{
+    struct Event
+    {
+        ProfilerZone zone;
+        uint32_t     thread;
+    };
+
+    std::vector<Event> events;
+    int64_t            origin = INT64_MAX;
+
+    for (uint32_t i = 0; i < PROFILER_MAX_THREADS; i++)
+    {
+        const ProfilerThread* thread = threads[i].load(std::memory_order_acquire);
+
+        if (!thread)
+        {
+            continue;
+        }
+
+        const uint32_t end   = thread->head.load(std::memory_order_acquire);
+        const uint32_t start = end > PROFILER_RING_SIZE ? end - PROFILER_RING_SIZE : 0;
+        const size_t   first = events.size();
+
+        for (uint32_t j = start; j < end; j++)
+        {
+            events.push_back({ thread->zones[j & (PROFILER_RING_SIZE - 1)], i });
+        }
+
+        // The owning thread may have overwritten the oldest zones meanwhile,
+        // and may be writing the one at `head` (aliasing `head - RING_SIZE`).
+        const uint32_t head  = thread->head.load(std::memory_order_acquire);
+        const uint32_t valid = head + 1 > PROFILER_RING_SIZE ? head + 1 - PROFILER_RING_SIZE : 0;
+
+        if (valid > start)
+        {
+            events.erase(
+                events.begin() + first,
+                events.begin() + first + bx::min(valid - start, end - start)
+            );
+        }
+    }
+
+    for (const Event& event : events)
+    {
+        origin = bx::min(origin, event.zone.start);
+    }
+
+    FILE* file = fopen(path, "wb");
+
+    if (!file)
+    {
+        WARN(false, "Failed to open trace file '%s'.", path);
+        return false;
+    }
+
+    const double to_microseconds = 1.0e6 / double(bx::getHPFrequency());
+
+    fputs("{\"traceEvents\":[\n", file);
+
+    for (size_t i = 0; i < events.size(); i++)
+    {
+        const Event& event = events[i];
+
+        fputs("{\"name\":", file);
+        write_json_string(file, event.zone.name);
+        fprintf(
+            file,
+            ",\"ph\":\"X\",\"pid\":0,\"tid\":%" PRIu32 ",\"ts\":%.3f,\"dur\":%.3f}%s\n",
+            event.thread,
+            double(event.zone.start - origin) * to_microseconds,
+            double(event.zone.end - event.zone.start) * to_microseconds,
+            i + 1 < events.size() ? "," : ""
+        );
+    }
+
+    fputs("]}\n", file);
+
+    const bool success = !ferror(file);
+
+    fclose(file);
+
+    return success;
+}
+
+
+// -----------------------------------------------------------------------------
+// DYNAMIC RESOLUTION
+// -----------------------------------------------------------------------------
+
+// Frame time tolerance band, relative to the target.
+static constexpr double DYNAMIC_RESOLUTION_UPPER_BAND = 1.05;
+static constexpr double DYNAMIC_RESOLUTION_LOWER_BAND = 0.85;
+
+// Frames to wait after a scale change, before the next one.
+static constexpr uint32_t DYNAMIC_RESOLUTION_COOLDOWN = 15;
+
+// Maximum scale increase per change.
+static constexpr float DYNAMIC_RESOLUTION_STEP_UP = 0.05f;
+
+void DynamicResolution::init()
+{
+    timer.tic();
+
+    target_time  = 0.0;
+    average_time = 0.0;
+    min_scale    = 1.0f;
+    max_scale    = 1.0f;
+    scale        = 1.0f;
+    cooldown     = 0;
+    pass_mask    = 0;
+}
+
+void DynamicResolution::configure(double target_time_, float min_scale_, float max_scale_)
+{
+    ASSERT(
+        min_scale_ > 0.0f && min_scale_ <= max_scale_,
+        "Invalid dynamic resolution scale bounds."
+    );
+
+    target_time  = target_time_;
+    average_time = target_time_;
+    min_scale    = min_scale_;
+    max_scale    = max_scale_;
+    cooldown     = DYNAMIC_RESOLUTION_COOLDOWN;
+}
+
+bool DynamicResolution::update()
+{
+    const double frame_time = timer.toc(true);
+
+    if (target_time <= 0.0)
+    {
+        const bool changed = scale != 1.0f;
+
+        scale = 1.0f;
+
+        return changed;
+    }
+
+    // Exponential moving average, to ignore single spikes.
+    average_time += (frame_time - average_time) * 0.1;
+
+    if (cooldown > 0)
+    {
+        cooldown--;
+
+        return false;
+    }
+
+    float new_scale = scale;
+
+    if (average_time > target_time * DYNAMIC_RESOLUTION_UPPER_BAND)
+    {
+        // Pixel count is proportional to the squared scale.
+        new_scale = scale * bx::sqrt(float(target_time / average_time));
+    }
+    else if (average_time < target_time * DYNAMIC_RESOLUTION_LOWER_BAND)
+    {
+        new_scale = bx::min(scale * bx::sqrt(float(target_time / average_time)), scale + DYNAMIC_RESOLUTION_STEP_UP);
+    }
+
+    // Quantized, so that tiny changes don't trigger viewport updates.
+    new_scale = bx::clamp(bx::round(new_scale * 64.0f) / 64.0f, min_scale, max_scale);
+
+    if (new_scale == scale)
+    {
+        return false;
+    }
+
+    scale    = new_scale;
+    cooldown = DYNAMIC_RESOLUTION_COOLDOWN;
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// DRAW STATE & SUBMISSION
+// -----------------------------------------------------------------------------
+
+static constexpr uint32_t BLEND_STATE_SHIFT      = 0;
+static constexpr uint32_t BLEND_STATE_MASK       = STATE_BLEND_ADD   |
+                                                   STATE_BLEND_ALPHA |
+                                                   STATE_BLEND_MAX   |
+                                                   STATE_BLEND_MIN   ;
+
+static constexpr uint32_t CULL_STATE_SHIFT       = 4;
+static constexpr uint32_t CULL_STATE_MASK        = STATE_CULL_CCW |
+                                                   STATE_CULL_CW  ;
+
+static constexpr uint32_t DEPTH_TEST_STATE_SHIFT = 6;
+static constexpr uint32_t DEPTH_TEST_STATE_MASK  = STATE_DEPTH_TEST_GEQUAL  |
+                                                   STATE_DEPTH_TEST_GREATER |
+                                                   STATE_DEPTH_TEST_LEQUAL  |
+                                                   STATE_DEPTH_TEST_LESS    ;
+
+static uint64_t translate_primitive_flags(uint32_t mesh_flags)
+{
+    constexpr uint64_t primitive[] =
+    {
+        0, // Triangles.
+        0, // Quads (for users, triangles internally).
+        BGFX_STATE_PT_TRISTRIP,
+        BGFX_STATE_PT_LINES,
+        BGFX_STATE_PT_LINESTRIP,
+        BGFX_STATE_PT_POINTS,
+    };
+
+    return primitive[(mesh_flags & PRIMITIVE_TYPE_MASK) >> PRIMITIVE_TYPE_SHIFT];
+}
+
+static uint64_t translate_draw_state_flags(uint32_t draw_flags, uint32_t mesh_flags)
+{
+    constexpr uint64_t blend[] =
+    {
+        0,
+        BGFX_STATE_BLEND_ADD,
+        BGFX_STATE_BLEND_ALPHA,
+        BGFX_STATE_BLEND_LIGHTEN,
+        BGFX_STATE_BLEND_DARKEN,
+    };
+
+    constexpr uint64_t cull[] =
+    {
+        0,
+        BGFX_STATE_CULL_CCW,
+        BGFX_STATE_CULL_CW,
+    };
+
+    constexpr uint64_t depth_test[] =
+    {
+        0,
+        BGFX_STATE_DEPTH_TEST_GEQUAL,
+        BGFX_STATE_DEPTH_TEST_GREATER,
+        BGFX_STATE_DEPTH_TEST_LEQUAL,
+        BGFX_STATE_DEPTH_TEST_LESS,
+    };
+
+    return
+        translate_primitive_flags(mesh_flags)                                          |
+        blend     [(draw_flags & BLEND_STATE_MASK     ) >> BLEND_STATE_SHIFT         ] |
+        cull      [(draw_flags & CULL_STATE_MASK      ) >> CULL_STATE_SHIFT          ] |
+        depth_test[(draw_flags & DEPTH_TEST_STATE_MASK) >> DEPTH_TEST_STATE_SHIFT    ] |
+
+        // TODO : Change the conditionals to shifts as well.
+        (          (draw_flags & STATE_MSAA           ) ?  BGFX_STATE_MSAA        : 0) |
+        (          (draw_flags & STATE_WRITE_A        ) ?  BGFX_STATE_WRITE_A     : 0) |
+        (          (draw_flags & STATE_WRITE_RGB      ) ?  BGFX_STATE_WRITE_RGB   : 0) |
+        (          (draw_flags & STATE_WRITE_Z        ) ?  BGFX_STATE_WRITE_Z     : 0) ;
+}
+
+void DrawState::reset()
+{
+    mesh            = nullptr;
+    transform       = nullptr;
+    instances       = nullptr;
+    material        = nullptr;
+    uniforms        = {};
+    transform_index = UINT32_MAX;
+    element_start   = 0;
+    element_count   = UINT32_MAX;
+    flags           = STATE_DEFAULT;
+    pass            = UINT16_MAX;
+    framebuffer     = BGFX_INVALID_HANDLE;
+    program         = BGFX_INVALID_HANDLE;
+    texture         = BGFX_INVALID_HANDLE;
+    sampler         = BGFX_INVALID_HANDLE;
+}
+
+bgfx::ProgramHandle DrawState::select_program(const DefaultProgramCache& default_programs) const
+{
+    bgfx::ProgramHandle selected = program;
+
+    if (material && bgfx::isValid(material->program))
+    {
+        selected = material->program;
+    }
+
+    if (instances && selected.idx == default_programs[mesh->flags].idx)
+    {
+        REQUIRE(
+            instances->is_transform,
+            "Custom instance data require a custom program."
+        );
+
+        if (instances->is_transform)
+        {
+            selected = default_programs[mesh->flags | INSTANCING_SUPPORTED];
+        }
+    }
+
+    REQUIRE(
+        bgfx::isValid(selected),
+        "Invalid draw state program."
+    );
+
+    return selected;
+}
+
+void DrawState::submit(bgfx::Encoder& encoder, UniformStaging& staging, TextureCache& textures, const DefaultProgramCache& default_programs)
+{
+    PROFILE_ZONE("DrawState::submit");
+
+    mesh->bind(encoder, element_start, element_count);
+
+    const bgfx::ProgramHandle draw_program = select_program(default_programs);
+    uint64_t                  draw_state   = 0;
+
+    if (material)
+    {
+        if (bgfx::isValid(material->texture) && bgfx::isValid(material->sampler))
+        {
+            encoder.setTexture(0, material->sampler, material->texture);
+
+            textures.touch(material->texture);
+        }
+
+        draw_state = material->state | translate_primitive_flags(mesh->flags);
+    }
+    else
+    {
+        if (bgfx::isValid(texture) && bgfx::isValid(sampler))
+        {
+            encoder.setTexture(0, sampler, texture);
+
+            textures.touch(texture);
+        }
+
+        draw_state = translate_draw_state_flags(flags, mesh->flags);
+    }
+
+    staging.begin_draw(encoder, pass, draw_program, draw_state);
+
+    if (material)
+    {
+        material->bind_uniforms(encoder, staging);
+    }
+
+    staging.bind(encoder, uniforms);
+
+    encoder.setState(draw_state);
+
+    if (instances)
+    {
+        encoder.setInstanceDataBuffer(&instances->buffer);
+    }
+
+    if (transform_index != UINT32_MAX)
+    {
+        encoder.setTransform(transform_index);
+    }
+    else
+    {
+        encoder.setTransform(transform);
+    }
+
+    encoder.submit(pass, draw_program);
+
+    reset();
+}
+
+void DrawState::submit(DeferredDrawQueue& queue, ArenaAllocator& allocator, const hmm_mat4& view_matrix, const DefaultProgramCache& default_programs)
+{
+    DrawRecord* record = nullptr;
+    allocate(record, allocator);
+    REQUIRE(
+        record != nullptr,
+        "Failed to allocate deferred draw record."
+    );
+
+    fill(*record, default_programs);
+
+    // Squared view-space distance of the model origin, so that the result
+    // doesn't depend on the handedness of the view matrix. No transform means
+    // identity, just as in the immediate path.
+    const hmm_vec4 origin = view_matrix * (transform
+        ? HMM_Vec4(transform->Elements[3][0], transform->Elements[3][1], transform->Elements[3][2], 1.0f)
+        : HMM_Vec4(0.0f, 0.0f, 0.0f, 1.0f)
+    );
+
+    queue.push(record, origin.X * origin.X + origin.Y * origin.Y + origin.Z * origin.Z);
+
+    reset();
+}
+
+void DrawState::submit(DrawList& list, const DefaultProgramCache& default_programs)
+{
+    REQUIRE(
+        mesh->type() == MeshType::STATIC,
+        "Only static meshes can be recorded into draw lists."
+    );
+
+    REQUIRE(
+        !instances,
+        "Instance buffers can't be recorded into draw lists."
+    );
+
+    REQUIRE(
+        uniforms.empty(),
+        "Uniform values can't be recorded into draw lists, use materials instead."
+    );
+
+    DrawRecord& record = list.records.emplace_back();
+    fill(record, default_programs);
+
+    // NOTE : Cached transforms are only valid in the current frame.
+    record.transform_index = UINT32_MAX;
+
+    reset();
+}
+
+void DrawState::fill(DrawRecord& record, const DefaultProgramCache& default_programs) const
+{
+    record.transform       = transform ? *transform : HMM_Mat4d(1.0f);
+    record.mesh            = mesh;
+    record.instances       = instances ? &instances->buffer : nullptr;
+    record.material        = material;
+    record.uniforms        = uniforms;
+    record.transform_index = transform_index;
+    record.element_start   = element_start;
+    record.element_count   = element_count;
+    record.pass            = pass;
+
+    record.program         = select_program(default_programs);
+
+    if (material)
+    {
+        record.state   = material->state | translate_primitive_flags(mesh->flags);
+        record.texture = material->texture;
+        record.sampler = material->sampler;
+    }
+    else
+    {
+        record.state   = translate_draw_state_flags(flags, mesh->flags);
+        record.texture = texture;
+        record.sampler = sampler;
+    }
+}
+
+bool DrawState::is_visible(const OcclusionBuffer& occlusion) const
+{
+    if (occlusion.pass.load(std::memory_order_acquire) != pass || mesh->element_count == 0)
+    {
+        return true;
+    }
+
+    return occlusion.is_visible(transform ? *transform : HMM_Mat4d(1.0f), mesh->bounds_min, mesh->bounds_max);
+}
+
+bool DrawRecord::shares_geometry(const DrawRecord& other) const
+{
+    if (mesh == other.mesh)
+    {
+        return
+            element_start == other.element_start &&
+            element_count == other.element_count ;
+    }
+
+    // Different meshes only share the bindings if they resolve to the same
+    // ranges of the same pooled buffers (see `Mesh::bind`).
+    if (!mesh->pooled || !other.mesh->pooled)
+    {
+        return false;
+    }
+
+    const uint32_t start       = bx::min(element_start      , mesh      ->element_count);
+    const uint32_t other_start = bx::min(other.element_start, other.mesh->element_count);
+    const uint32_t count       = bx::min(element_count      , mesh      ->element_count - start      );
+    const uint32_t other_count = bx::min(other.element_count, other.mesh->element_count - other_start);
+
+    return
+        mesh->pooled_vertex_buffer.idx == other.mesh->pooled_vertex_buffer.idx   &&
+        mesh->pooled_index_buffer .idx == other.mesh->pooled_index_buffer .idx   &&
+        mesh->base_vertex              == other.mesh->base_vertex                &&
+        mesh->vertex_count             == other.mesh->vertex_count               &&
+        mesh->first_index + start      == other.mesh->first_index + other_start &&
+        count                          == other_count                            ;
+}
+
+bool DrawRecord::shares_texture(const DrawRecord& other) const
+{
+    return
+        texture.idx == other.texture.idx &&
+        sampler.idx == other.sampler.idx ;
+}
+
+static void bind_draw_geometry(bgfx::Encoder& encoder, const DrawRecord& record)
+{
+    record.mesh->bind(encoder, record.element_start, record.element_count);
+}
+
+static void bind_draw_texture(bgfx::Encoder& encoder, TextureCache& textures, const DrawRecord& record)
+{
+    if (bgfx::isValid(record.texture) && bgfx::isValid(record.sampler))
+    {
+        encoder.setTexture(0, record.sampler, record.texture);
+
+        textures.touch(record.texture);
+    }
+}
+
+void DrawRecord::submit(bgfx::Encoder& encoder, UniformStaging& staging, TextureCache& textures, const DrawRecord* previous, const DrawRecord* next, uint32_t parent_transform_index) const
+{
+    // Bindings kept alive by the previous submission (see the discard flags
+    // below) don't have to be set again.
+    if (!previous || !shares_geometry(*previous))
+    {
+        bind_draw_geometry(encoder, *this);
+    }
+
+    if (!previous || !shares_texture(*previous))
+    {
+        bind_draw_texture(encoder, textures, *this);
+    }
+
+    if (instances)
+    {
+        encoder.setInstanceDataBuffer(instances);
+    }
+
+    staging.begin_draw(encoder, pass, program, state);
+
+    if (material)
+    {
+        material->bind_uniforms(encoder, staging);
+    }
+
+    staging.bind(encoder, uniforms);
+
+    encoder.setState(state);
+
+    if (parent_transform_index != UINT32_MAX)
+    {
+        encoder.setTransform(parent_transform_index);
+    }
+    else if (transform_index != UINT32_MAX)
+    {
+        encoder.setTransform(transform_index);
+    }
+    else
+    {
+        encoder.setTransform(&transform);
+    }
+
+    uint8_t discard = BGFX_DISCARD_ALL;
+
+    if (next && shares_geometry(*next))
+    {
+        discard &= ~(BGFX_DISCARD_VERTEX_STREAMS | BGFX_DISCARD_INDEX_BUFFER);
+    }
 
-    dirty_flags     = DIRTY_CLEAR;
+    if (next && shares_texture(*next))
+    {
+        discard &= ~BGFX_DISCARD_BINDINGS;
+    }
+
+    encoder.submit(pass, program, 0, discard);
 }
 
-void Pass::update(bgfx::ViewId id, bool backbuffer_size_changed)
+// Returns the index of the first record from `start` that can be submitted,
+// or the record count if there's none.
+static uint32_t find_valid_record(const std::vector<DrawRecord>& records, uint32_t start)
 {
-    if (dirty_flags & DIRTY_TOUCH)
+    for (; start < records.size(); start++)
     {
-        bgfx::touch(id);
-    }
+        // The recorded mesh ID might have been reused since.
+        const Mesh* mesh = records[start].mesh;
 
-    if (dirty_flags & DIRTY_CLEAR)
-    {
-        bgfx::setViewClear(id, clear_flags, clear_rgba, clear_depth, clear_stencil);
+        if (mesh->is_valid() && mesh->type() == MeshType::STATIC)
+        {
+            break;
+        }
     }
 
-    if (dirty_flags & DIRTY_TRANSFORM)
+    return start;
+}
+
+void DrawList::submit(bgfx::Encoder& encoder, UniformStaging& staging, TextureCache& textures, const hmm_mat4* parent) const
+{
+    const uint32_t count = uint32_t(records.size());
+
+    if (count == 0)
     {
-        bgfx::setViewTransform(id, &view_matrix, &proj_matrix);
+        return;
     }
 
-    if ((dirty_flags & DIRTY_RECT) || (backbuffer_size_changed && viewport_width >= SIZE_EQUAL))
+    // With a parent transform, all the combined matrices are written with a
+    // single cache allocation.
+    uint32_t first_transform = UINT32_MAX;
+
+    if (parent)
     {
-        if (viewport_width >= SIZE_EQUAL)
+        bgfx::Transform transforms;
+        first_transform = encoder.allocTransform(&transforms, uint16_t(count));
+
+        WARN(
+            transforms.num == count,
+            "Failed to allocate %" PRIu32 " draw list transforms.",
+            count
+        );
+
+        if (transforms.num != count)
         {
-            bgfx::setViewRect(id, viewport_x, viewport_y, bgfx::BackbufferRatio::Enum(viewport_width - SIZE_EQUAL));
+            return;
         }
-        else
+
+        for (uint32_t i = 0; i < count; i++)
         {
-            bgfx::setViewRect(id, viewport_x, viewport_y, viewport_width, viewport_height);
+            const hmm_mat4 combined = *parent * records[i].transform;
+
+            memcpy(transforms.data + 16 * i, &combined, sizeof(combined));
         }
     }
 
-    if ((dirty_flags & DIRTY_FRAMEBUFFER) || backbuffer_size_changed)
+    // Invalid records are skipped, so the neighbours deciding which bindings
+    // are kept have to be the nearest actually submitted ones.
+    const DrawRecord* previous = nullptr;
+
+    for (uint32_t i = find_valid_record(records, 0); i < count;)
     {
-        // Having `BGFX_INVALID_HANDLE` here is OK.
-        bgfx::setViewFrameBuffer(id, framebuffer);
-    }
+        const uint32_t next = find_valid_record(records, i + 1);
+
+        records[i].submit(
+            encoder,
+            staging,
+            textures,
+            previous,
+            next < count ? &records[next] : nullptr,
+            parent ? first_transform + i : UINT32_MAX
+        );
 
-    dirty_flags = DIRTY_NONE;
+        previous = &records[i];
+        i        = next;
+    }
 }
 
-void Pass::touch()
+void DrawListCache::init()
 {
-    dirty_flags |= DIRTY_TOUCH;
+    for (DrawList& list : lists)
+    {
+        list.records.clear();
+    }
 }
 
-void Pass::set_view(const hmm_mat4& matrix)
+void DrawListCache::cleanup()
 {
-    view_matrix  = matrix;
-    dirty_flags |= DIRTY_TRANSFORM;
+    for (DrawList& list : lists)
+    {
+        std::vector<DrawRecord>().swap(list.records);
+    }
 }
 
-void Pass::set_projection(const hmm_mat4& matrix)
+void DrawListCache::add_list(uint32_t id, DrawList& list, TextureCache& textures)
 {
-    proj_matrix  = matrix;
-    dirty_flags |= DIRTY_TRANSFORM;
+    // NOTE : Not thread safe because users shouldn't record draw lists with
+    //        the same ID from multiple threads in the first place.
+
+    for (const DrawRecord& record : list.records)
+    {
+        textures.pin(record.texture);
+    }
+
+    for (const DrawRecord& record : lists[id].records)
+    {
+        textures.unpin(record.texture);
+    }
+
+    lists[id].records.swap(list.records);
+
+    list.records.clear();
 }
 
-void Pass::set_framebuffer(bgfx::FrameBufferHandle framebuffer_)
+// Sort key layout (from the most significant bit):
+//
+//   opaque:      | pass (6) | 0 | program (9) | texture (12) | mesh (12) | state (8) | depth (16) |
+//   translucent: | pass (6) | 1 |                  submission order (57)                        |
+//
+// Blended draws thus follow all opaque ones in their pass, in the order they
+// were submitted, while the opaque ones are grouped by their bindings and then
+// sorted front-to-back.
+static constexpr uint32_t SORT_KEY_PASS_SHIFT        = 58;
+static constexpr uint32_t SORT_KEY_TRANSLUCENT_SHIFT = 57;
+static constexpr uint32_t SORT_KEY_PROGRAM_SHIFT     = 48;
+static constexpr uint32_t SORT_KEY_TEXTURE_SHIFT     = 36;
+static constexpr uint32_t SORT_KEY_MESH_SHIFT        = 24;
+static constexpr uint32_t SORT_KEY_STATE_SHIFT       = 16;
+
+static_assert(
+    MAX_PASSES <= 64,
+    "Pass count doesn't fit into the sort key."
+);
+
+static uint64_t fold_draw_state_bits(uint64_t state)
 {
-    framebuffer  = framebuffer_;
-    dirty_flags |= DIRTY_FRAMEBUFFER;
+    state ^= state >> 32;
+    state ^= state >> 16;
+    state ^= state >> 8;
+
+    return state & 0xff;
 }
 
-void Pass::set_no_clear()
+static uint64_t quantize_draw_depth(float depth)
 {
-    clear_flags  = BGFX_CLEAR_NONE;
-    dirty_flags |= DIRTY_CLEAR;
+    union
+    {
+        float    f;
+        uint32_t u;
+    } bits = { depth };
+
+    // Makes the bit pattern monotonic for negative values as well.
+    bits.u ^= (bits.u & 0x80000000) ? 0xffffffff : 0x80000000;
+
+    return bits.u >> 16;
 }
 
-void Pass::set_clear_depth(float depth)
+void DeferredDrawQueue::init()
 {
-    clear_flags |= BGFX_CLEAR_DEPTH;
-    clear_depth  = depth;
-    dirty_flags |= DIRTY_CLEAR;
+    keys        .clear();
+    records     .clear();
+    temp_keys   .clear();
+    temp_records.clear();
+
+    enabled = false;
 }
 
-void Pass::set_clear_color(uint32_t rgba)
+void DeferredDrawQueue::cleanup()
 {
-    clear_flags |= BGFX_CLEAR_COLOR;
-    clear_rgba   = rgba;
-    dirty_flags |= DIRTY_CLEAR;
+    std::vector<uint64_t   >().swap(keys        );
+    std::vector<DrawRecord*>().swap(records     );
+    std::vector<uint64_t   >().swap(temp_keys   );
+    std::vector<DrawRecord*>().swap(temp_records);
 }
 
-void Pass::set_viewport(uint16_t x, uint16_t y, uint16_t width, uint16_t height)
+void DeferredDrawQueue::push(DrawRecord* record, float depth)
 {
-    ASSERT(
-        width < SIZE_EQUAL || width == height,
-        "Symbolic viewport size must be the same in bot X and Y axes."
-    );
+    const uint64_t pass = uint64_t(record->pass) << SORT_KEY_PASS_SHIFT;
+    uint64_t       key  = 0;
 
-    viewport_x      = x;
-    viewport_y      = y;
-    viewport_width  = width;
-    viewport_height = height;
-    dirty_flags    |= DIRTY_RECT;
+    if (record->state & BGFX_STATE_BLEND_MASK)
+    {
+        key = pass | (1ull << SORT_KEY_TRANSLUCENT_SHIFT) | records.size();
+    }
+    else
+    {
+        const uint16_t vertex_buffer = record->mesh->vertex_buffer_index();
+
+        key = pass                                                            |
+            (uint64_t(record->program.idx & 0x1ff) << SORT_KEY_PROGRAM_SHIFT) |
+            (uint64_t(record->texture.idx & 0xfff) << SORT_KEY_TEXTURE_SHIFT) |
+            (uint64_t(vertex_buffer       & 0xfff) << SORT_KEY_MESH_SHIFT   ) |
+            (fold_draw_state_bits(record->state  ) << SORT_KEY_STATE_SHIFT  ) |
+            quantize_draw_depth(depth);
+    }
+
+    keys   .push_back(key   );
+    records.push_back(record);
 }
 
-void PassCache::init()
+// Shorter runs of identical draws aren't worth the instance buffer setup.
+static constexpr uint32_t MIN_AUTO_INSTANCED_DRAWS = 4;
+
+static bool have_same_values(std::span<const UniformValue> first, std::span<const UniformValue> other)
 {
-    for (Pass& pass : passes)
+    if (first.size() != other.size())
     {
-        pass.init();
+        return false;
     }
 
-    backbuffer_size_changed = true;
+    for (size_t i = 0; i < first.size(); i++)
+    {
+        if (first[i].handle.idx != other[i].handle.idx ||
+            first[i].size       != other[i].size       ||
+            memcmp(first[i].data, other[i].data, first[i].size))
+        {
+            return false;
+        }
+    }
+
+    return true;
 }
 
-void PassCache::update()
+static bool can_be_instanced_together(const DrawRecord& first, const DrawRecord& other)
 {
-    for (bgfx::ViewId id = 0; id < passes.size(); id++)
+    return
+        !first.instances                       &&
+        !other.instances                       &&
+        first.material    == other.material    &&
+        first.pass        == other.pass        &&
+        first.program.idx == other.program.idx &&
+        first.state       == other.state       &&
+        first.shares_geometry(other)           &&
+        first.shares_texture (other)           &&
+        have_same_values(first.uniforms, other.uniforms);
+}
+
+static bool submit_instanced(bgfx::Encoder& encoder, UniformStaging& staging, TextureCache& textures, DrawRecord* const* records, uint32_t count, bgfx::ProgramHandle program)
+{
+    constexpr uint16_t stride = sizeof(hmm_mat4);
+
+    if (bgfx::getAvailInstanceDataBuffer(count, stride) < count)
     {
-        passes[id].update(id, backbuffer_size_changed);
+        WARN(
+            false,
+            "Not enough instance buffer space for %" PRIu32 " automatically instanced draws.",
+            count
+        );
+
+        return false;
     }
 
-    backbuffer_size_changed = false;
-}
+    bgfx::InstanceDataBuffer buffer;
+    bgfx::allocInstanceDataBuffer(&buffer, count, stride);
 
+    for (uint32_t i = 0; i < count; i++)
+    {
+        memcpy(buffer.data + i * stride, &records[i]->transform, stride);
+    }
 
-// -----------------------------------------------------------------------------
-// TIME MEASUREMENT
-// -----------------------------------------------------------------------------
+    const DrawRecord& first = *records[0];
 
-static const double s_timer_inv_frequency = 1.0 / double(bx::getHPFrequency());
+    bind_draw_geometry(encoder, first);
+    bind_draw_texture (encoder, textures, first);
 
-void Timer::tic()
-{
-    tic(bx::getHPCounter());
-}
+    staging.begin_draw(encoder, first.pass, program, first.state);
 
-void Timer::tic(int64_t now)
-{
-    counter = now;
-}
+    if (first.material)
+    {
+        first.material->bind_uniforms(encoder, staging);
+    }
 
-double Timer::toc(bool restart)
-{
-    return toc(bx::getHPCounter(), restart);
+    staging.bind(encoder, first.uniforms);
+
+    encoder.setState(first.state);
+
+    // NOTE : No model transform is set, so the instancing shaders will
+    //        multiply the per-instance ones with identity.
+    encoder.setInstanceDataBuffer(&buffer);
+
+    encoder.submit(first.pass, program);
+
+    return true;
 }
 
-double Timer::toc(int64_t now, bool restart)
+void DeferredDrawQueue::flush(bgfx::Encoder& encoder, UniformStaging& staging, TextureCache& textures, const DefaultProgramCache& default_programs)
 {
-    elapsed = (now - counter) * s_timer_inv_frequency;
+    const uint32_t count = uint32_t(records.size());
 
-    if (restart)
+    if (count == 0)
     {
-        counter = now;
+        return;
     }
 
-    return elapsed;
-}
+    temp_keys   .resize(count);
+    temp_records.resize(count);
 
+    bx::radixSort(keys.data(), temp_keys.data(), records.data(), temp_records.data(), count);
 
-// -----------------------------------------------------------------------------
-// DRAW STATE & SUBMISSION
-// -----------------------------------------------------------------------------
+    // The sort scratch buffer is reused to store the length of instanced runs
+    // at their first record (zero for the rest of the run, and one for the
+    // records submitted individually).
+    uint64_t* runs = temp_keys.data();
 
-static constexpr uint32_t BLEND_STATE_SHIFT      = 0;
-static constexpr uint32_t BLEND_STATE_MASK       = STATE_BLEND_ADD   |
-                                                   STATE_BLEND_ALPHA |
-                                                   STATE_BLEND_MAX   |
-                                                   STATE_BLEND_MIN   ;
+    const bool instancing = bgfx::getCaps()->supported & BGFX_CAPS_INSTANCING;
 
-static constexpr uint32_t CULL_STATE_SHIFT       = 4;
-static constexpr uint32_t CULL_STATE_MASK        = STATE_CULL_CCW |
-                                                   STATE_CULL_CW  ;
+    for (uint32_t i = 0; i < count;)
+    {
+        const DrawRecord& first = *records[i];
+        uint32_t          run   = 1;
 
-static constexpr uint32_t DEPTH_TEST_STATE_SHIFT = 6;
-static constexpr uint32_t DEPTH_TEST_STATE_MASK  = STATE_DEPTH_TEST_GEQUAL  |
-                                                   STATE_DEPTH_TEST_GREATER |
-                                                   STATE_DEPTH_TEST_LEQUAL  |
-                                                   STATE_DEPTH_TEST_LESS    ;
+        if (instancing && first.program.idx == default_programs[first.mesh->flags].idx)
+        {
+            while (i + run < count && can_be_instanced_together(first, *records[i + run]))
+            {
+                run++;
+            }
+        }
 
-static uint64_t translate_draw_state_flags(uint32_t draw_flags, uint32_t mesh_flags)
-{
-    constexpr uint64_t blend[] =
-    {
-        0,
-        BGFX_STATE_BLEND_ADD,
-        BGFX_STATE_BLEND_ALPHA,
-        BGFX_STATE_BLEND_LIGHTEN,
-        BGFX_STATE_BLEND_DARKEN,
-    };
+        if (run < MIN_AUTO_INSTANCED_DRAWS)
+        {
+            run = 1;
+        }
 
-    constexpr uint64_t cull[] =
-    {
-        0,
-        BGFX_STATE_CULL_CCW,
-        BGFX_STATE_CULL_CW,
-    };
+        runs[i] = run;
 
-    constexpr uint64_t depth_test[] =
-    {
-        0,
-        BGFX_STATE_DEPTH_TEST_GEQUAL,
-        BGFX_STATE_DEPTH_TEST_GREATER,
-        BGFX_STATE_DEPTH_TEST_LEQUAL,
-        BGFX_STATE_DEPTH_TEST_LESS,
-    };
+        for (uint32_t j = 1; j < run; j++)
+        {
+            runs[i + j] = 0;
+        }
 
-    constexpr uint64_t primitive[] =
+        i += run;
+    }
+
+    for (uint32_t i = 0; i < count;)
     {
-        0, // Triangles.
-        0, // Quads (for users, triangles internally).
-        BGFX_STATE_PT_TRISTRIP,
-        BGFX_STATE_PT_LINES,
-        BGFX_STATE_PT_LINESTRIP,
-        BGFX_STATE_PT_POINTS,
-    };
+        const uint32_t run = uint32_t(runs[i]);
 
-    return
-        primitive [(mesh_flags & PRIMITIVE_TYPE_MASK  ) >> PRIMITIVE_TYPE_SHIFT      ] |
-        blend     [(draw_flags & BLEND_STATE_MASK     ) >> BLEND_STATE_SHIFT         ] |
-        cull      [(draw_flags & CULL_STATE_MASK      ) >> CULL_STATE_SHIFT          ] |
-        depth_test[(draw_flags & DEPTH_TEST_STATE_MASK) >> DEPTH_TEST_STATE_SHIFT    ] |
+        if (run > 1)
+        {
+            const bgfx::ProgramHandle program = default_programs[records[i]->mesh->flags | INSTANCING_SUPPORTED];
 
-        // TODO : Change the conditionals to shifts as well.
-        (          (draw_flags & STATE_MSAA           ) ?  BGFX_STATE_MSAA        : 0) |
-        (          (draw_flags & STATE_WRITE_A        ) ?  BGFX_STATE_WRITE_A     : 0) |
-        (          (draw_flags & STATE_WRITE_RGB      ) ?  BGFX_STATE_WRITE_RGB   : 0) |
-        (          (draw_flags & STATE_WRITE_Z        ) ?  BGFX_STATE_WRITE_Z     : 0) ;
+            if (bgfx::isValid(program) && submit_instanced(encoder, staging, textures, &records[i], run, program))
+            {
+                i += run;
+                continue;
+            }
+
+            for (uint32_t j = 0; j < run; j++)
+            {
+                records[i + j]->submit(
+                    encoder,
+                    staging,
+                    textures,
+                    j > 0       ? records[i + j - 1] : nullptr,
+                    j + 1 < run ? records[i + j + 1] : nullptr
+                );
+            }
+
+            i += run;
+            continue;
+        }
+
+        // Instanced submissions discard all their bindings, so they can't be
+        // relied upon by their neighbors.
+        records[i]->submit(
+            encoder,
+            staging,
+            textures,
+            i > 0         && runs[i - 1] == 1 ? records[i - 1] : nullptr,
+            i + 1 < count && runs[i + 1] == 1 ? records[i + 1] : nullptr
+        );
+
+        i++;
+    }
+
+    // NOTE : Records themselves live in the frame arena and die with it.
+    keys   .clear();
+    records.clear();
 }
 
-void DrawState::reset()
+
+// -----------------------------------------------------------------------------
+// MATERIALS
+// -----------------------------------------------------------------------------
+
+void Material::create(const DrawState& draw_state)
 {
-    mesh          = nullptr;
-    transform     = nullptr;
-    element_start = 0;
-    element_count = UINT32_MAX;
-    flags         = STATE_DEFAULT;
-    pass          = UINT16_MAX;
-    framebuffer   = BGFX_INVALID_HANDLE;
-    program       = BGFX_INVALID_HANDLE;
-    texture       = BGFX_INVALID_HANDLE;
-    sampler       = BGFX_INVALID_HANDLE;
+    uniforms.clear();
+    values  .clear();
+
+    // NOTE : Primitive type bits depend on the mesh and are added per draw.
+    state   = translate_draw_state_flags(draw_state.flags, 0);
+    program = draw_state.program;
+    texture = draw_state.texture;
+    sampler = draw_state.sampler;
 }
 
-void DrawState::submit(bgfx::Encoder& encoder)
+void Material::add_uniform(bgfx::UniformHandle handle, const void* value, uint16_t count, uint32_t size)
 {
-    if (mesh->type() == MeshType::STATIC)
+    const uint32_t offset = uint32_t(values.size());
+    const uint8_t* bytes  = static_cast<const uint8_t*>(value);
+
+    values  .insert(values.end(), bytes, bytes + size);
+    uniforms.push_back({ handle, count, offset });
+}
+
+void Material::bind_uniforms(bgfx::Encoder& encoder, UniformStaging& staging) const
+{
+    for (const MaterialUniform& uniform : uniforms)
     {
-        encoder.setVertexBuffer(0, mesh->static_vertex_buffer);
-        encoder.setIndexBuffer (   mesh->static_index_buffer, element_start, element_count);
+        encoder.setUniform(uniform.handle, values.data() + uniform.offset, uniform.count);
+
+        // Material values aren't tracked, as the material can be rebuilt.
+        staging.forget(uniform.handle);
     }
-    else
+}
+
+void MaterialCache::init()
+{
+    DrawState defaults;
+    defaults.reset();
+
+    for (Material& material : materials)
     {
-        encoder.setVertexBuffer(0, mesh->transient_vertex_buffer, element_start, element_count);
+        material.create(defaults);
     }
+}
 
-    if (bgfx::isValid(texture) && bgfx::isValid(sampler))
+void MaterialCache::cleanup()
+{
+    for (Material& material : materials)
     {
-        encoder.setTexture(0, sampler, texture);
+        std::vector<MaterialUniform>().swap(material.uniforms);
+        std::vector<uint8_t        >().swap(material.values  );
     }
+}
 
-    encoder.setState(translate_draw_state_flags(flags, mesh->flags));
+void MaterialCache::add_material(uint32_t id, Material& material, TextureCache& textures)
+{
+    // NOTE : Not thread safe because users shouldn't create materials with the
+    //        same ID from multiple threads in the first place. The slot itself
+    //        is updated in place, as it might be referenced by draw lists.
 
-    encoder.setTransform(transform);
+    textures.pin  (material     .texture);
+    textures.unpin(materials[id].texture);
 
-    REQUIRE(
-        bgfx::isValid(program),
-        "Invalid draw state program."
-    );
-    encoder.submit(pass, program);
+    materials[id] = std::move(material);
 
-    reset();
+    material = {};
 }
 
 
@@ -1217,11 +5560,20 @@ void ThreadLocalContext::init(uint32_t frame_memory)
 
     frame_allocator.init({ double_frame_memory.data(), frame_memory });
     matrix_stack   .init();
+    transform_cache.reset();
+    uniform_staging.init();
     draw_state     .reset();
+    draw_queue     .init();
 }
 
 void ThreadLocalContext::cleanup()
 {
+    draw_queue     .cleanup();
+    uniform_staging.cleanup();
+
+    std::vector<DrawRecord>().swap(draw_list_recorder.records);
+    std::vector<uint32_t  >().swap(batch_recorder    .parts  );
+
     std::vector<uint8_t>().swap(double_frame_memory);
 }
 
@@ -1235,6 +5587,14 @@ void ThreadLocalContext::swap_frame_allocator_memory()
     }
 
     frame_allocator.init({ double_frame_memory.data() + offset, frame_allocator.buffer.size() });
+
+    // Cached BGFX transform indices refer to the previous frame's cache, while
+    // the matrix stack IDs they're keyed by persist across frames.
+    transform_cache.reset();
+
+    // Tracked uniform values point into the memory that's about to be reused,
+    // and BGFX hands out the same encoder pointers again.
+    uniform_staging.reset();
 }
 
 
@@ -1244,22 +5604,44 @@ void ThreadLocalContext::swap_frame_allocator_memory()
 
 void GlobalContext::init()
 {
-    meshes          .init();
-    passes          .init();
-    vertex_layouts  .init();
-
-    default_uniforms.init();
-    default_programs.init();
-    textures        .init();
+    draw_lists        .init();
+    dynamic_resolution.init();
+    materials         .init();
+    meshes            .init();
+    passes            .init();
+    texture_compressor.init();
+    vertex_layouts    .init();
+
+    default_uniforms  .init();
+    default_programs  .init();
+    instances         .init();
+    occlusion         .init();
+    texture_atlases   .init();
+    textures          .init();
+    texture_streamer  .init();
+    transient_targets .init();
+    texture_updates   .init();
+    uniforms          .init();
+    screen_readback   .init();
 }
 
 void GlobalContext::cleanup()
 {
-    textures        .cleanup();
-    default_uniforms.cleanup();
-    default_programs.cleanup();
-
-    meshes          .cleanup();
+    screen_readback   .cleanup();
+    uniforms          .cleanup();
+    texture_updates   .cleanup();
+    transient_targets .cleanup();
+    texture_streamer  .cleanup();
+    textures          .cleanup();
+    texture_atlases   .cleanup();
+    occlusion         .cleanup();
+    default_uniforms  .cleanup();
+    default_programs  .cleanup();
+
+    texture_compressor.cleanup();
+    meshes            .cleanup();
+    materials         .cleanup();
+    draw_lists        .cleanup();
 }
 
 
@@ -11,4 +11,11 @@
 #include <shaders/position_normal_fs.h>         // position_normal_fs
 #include <shaders/position_normal_vs.h>         // position_normal_vs
 #include <shaders/position_texcoord_fs.h>       // position_texcoord_fs
-#include <shaders/position_texcoord_vs.h>       // position_texcoord_vs
\ No newline at end of file
+#include <shaders/position_texcoord_vs.h>       // position_texcoord_vs
+
+#include <shaders/instancing_position_vs.h>                // instancing_position_vs
+#include <shaders/instancing_position_color_vs.h>          // instancing_position_color_vs
+#include <shaders/instancing_position_color_normal_vs.h>   // instancing_position_color_normal_vs
+#include <shaders/instancing_position_color_texcoord_vs.h> // instancing_position_color_texcoord_vs
+#include <shaders/instancing_position_normal_vs.h>         // instancing_position_normal_vs
+#include <shaders/instancing_position_texcoord_vs.h>       // instancing_position_texcoord_vs
\ No newline at end of file
@@ -0,0 +1,12 @@
+$input  a_position, a_normal, i_data0, i_data1, i_data2, i_data3
+$output v_normal
+
+#include <bgfx_shader.sh>
+#include <shaderlib.sh>
+
+void main()
+{
+    mat4 model  = mul(u_model[0], mtxFromCols(i_data0, i_data1, i_data2, i_data3));
+    gl_Position = mul(u_viewProj, mul(model, vec4(a_position, 1.0)));
+    v_normal    = mul(u_view, mul(model, vec4(decodeNormalUint(a_normal), 0.0))).xyz;
+}
@@ -0,0 +1,69 @@
+#include <mnm_internal.h>
+
+#include <stdio.h>           // fprintf
+
+#include <bgfx/bgfx.h>       // FrameBufferHandle, ViewId
+
+namespace mnm
+{
+
+// -----------------------------------------------------------------------------
+// HARNESS
+// -----------------------------------------------------------------------------
+
+static int s_failures = 0;
+
+#define CHECK(condition) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            fprintf(stderr, "%s:%i: Check '%s' failed.\n", __FILE__, __LINE__, #condition); \
+            s_failures++; \
+        } \
+    } \
+    while (false)
+
+
+// -----------------------------------------------------------------------------
+// RENDER GRAPH
+// -----------------------------------------------------------------------------
+
+// Offscreen scene pass writes a texture, backbuffer pass samples it, and an
+// overlay is drawn over it into the backbuffer. The overlay must not be moved
+// ahead of the first backbuffer pass.
+static void test_graph_keeps_framebuffer_order()
+{
+    static PassCache cache;
+    cache.init();
+
+    cache.graph_enabled = true;
+
+    constexpr uint32_t scene_texture = 1;
+
+    cache.passes[0].framebuffer = bgfx::FrameBufferHandle{ 0 };
+    cache.passes[0].writes.set(scene_texture);
+
+    cache.passes[1].reads.set(scene_texture);
+
+    cache.passes[2].output = true;
+
+    cache.compile_graph();
+
+    CHECK(cache.order[0] == 0);
+    CHECK(cache.order[1] == 1);
+    CHECK(cache.order[2] == 2);
+
+    CHECK(cache.is_active(0));
+    CHECK(cache.is_active(1));
+    CHECK(cache.is_active(2));
+}
+
+} // namespace mnm
+
+int main()
+{
+    mnm::test_graph_keeps_framebuffer_order();
+
+    return mnm::s_failures ? 1 : 0;
+}
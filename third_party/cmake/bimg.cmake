@@ -1,28 +1,24 @@
 set(BIMG_DIR ${bimg_SOURCE_DIR})
 
+file(GLOB ASTC_CODEC_SOURCE_FILES
+    ${BIMG_DIR}/3rdparty/astc-codec/src/decoder/*.cc
+)
+
 set(BIMG_SOURCE_FILES
     ${BIMG_DIR}/src/image.cpp
     ${BIMG_DIR}/src/image_gnf.cpp
+    ${ASTC_CODEC_SOURCE_FILES}
 )
 
-# MSVC does not optimize-out the compile-time disabled (via BIMG_DECODE_ENABLE = 0)
-# parts, so we have to provide fake implementation to remove the linker errors.
-if(MSVC)
-    list(APPEND BIMG_SOURCE_FILES "cmake/bimg_patch.cpp")
-endif()
-
 add_library(bimg STATIC
     ${BIMG_SOURCE_FILES}
 )
 
-target_compile_definitions(bimg PRIVATE
-    -DBIMG_DECODE_ENABLE=0
-)
-
 target_include_directories(bimg
     PUBLIC
         ${BIMG_DIR}/include
     PRIVATE
+        ${BIMG_DIR}/3rdparty/astc-codec
         ${BIMG_DIR}/3rdparty/astc-codec/include
 )
 
@@ -34,4 +30,68 @@ set_target_properties(bimg PROPERTIES
     CXX_STANDARD 17
     CXX_EXTENSIONS OFF
     CXX_STANDARD_REQUIRED ON
-)
\ No newline at end of file
+)
+
+# Image file decoding (PNG, JPEG, EXR, etc.), used by asynchronous texture
+# loading.
+add_library(bimg_decode STATIC
+    ${BIMG_DIR}/src/image_decode.cpp
+    ${BIMG_DIR}/3rdparty/tinyexr/deps/miniz/miniz.c
+)
+
+target_include_directories(bimg_decode
+    PUBLIC
+        ${BIMG_DIR}/include
+    PRIVATE
+        ${BIMG_DIR}/3rdparty
+        ${BIMG_DIR}/3rdparty/tinyexr/deps/miniz
+)
+
+target_link_libraries(bimg_decode PRIVATE
+    bimg
+    bx
+)
+
+set_target_properties(bimg_decode PROPERTIES
+    CXX_STANDARD 17
+    CXX_EXTENSIONS OFF
+    CXX_STANDARD_REQUIRED ON
+)
+
+# CPU texture encoders (BCn, ETC, PVRTC, ASTC), used by the texture compression.
+file(GLOB_RECURSE BIMG_ENCODE_SOURCE_FILES
+    ${BIMG_DIR}/3rdparty/astc/*.cpp
+    ${BIMG_DIR}/3rdparty/edtaa3/*.cpp
+    ${BIMG_DIR}/3rdparty/etc1/*.cpp
+    ${BIMG_DIR}/3rdparty/etc2/*.cpp
+    ${BIMG_DIR}/3rdparty/iqa/source/*.c
+    ${BIMG_DIR}/3rdparty/libsquish/*.cpp
+    ${BIMG_DIR}/3rdparty/nvtt/*.cpp
+    ${BIMG_DIR}/3rdparty/pvrtc/*.cpp
+)
+
+add_library(bimg_encode STATIC
+    ${BIMG_DIR}/src/image_encode.cpp
+    ${BIMG_DIR}/src/image_cubemap_filter.cpp
+    ${BIMG_ENCODE_SOURCE_FILES}
+)
+
+target_include_directories(bimg_encode
+    PUBLIC
+        ${BIMG_DIR}/include
+    PRIVATE
+        ${BIMG_DIR}/3rdparty
+        ${BIMG_DIR}/3rdparty/iqa/include
+        ${BIMG_DIR}/3rdparty/nvtt
+)
+
+target_link_libraries(bimg_encode PRIVATE
+    bimg
+    bx
+)
+
+set_target_properties(bimg_encode PROPERTIES
+    CXX_STANDARD 17
+    CXX_EXTENSIONS OFF
+    CXX_STANDARD_REQUIRED ON
+)